@@ -78,7 +78,7 @@ int main(int argc, char *argv[])
 	 * Father
 	 */
 	/* for ask2-signals */
-	wait_for_ready_children(1);
+	wait_for_ready_pids(&pid, 1, 10000);
 
 	/* for ask2-{fork, tree} */
 	/* sleep(SLEEP_TREE_SEC); */
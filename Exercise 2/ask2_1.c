@@ -9,6 +9,7 @@
 
 #define SLEEP_PROC_SEC  10
 #define SLEEP_TREE_SEC  3
+#define EXIT_TIMEOUT_MS 60000	/*the whole tree must be done by then*/
 
 /*
  * Create this process tree:
@@ -30,8 +31,7 @@
  */
 int main(void)
 {
-	pid_t pid;
-	int status;
+	pid_t pid, kids[2];
 	/* Fork root of process tree */
 	pid = fork();
 	if (pid < 0) {
@@ -64,11 +64,11 @@ int main(void)
 				exit(13);
 			}	/*Father B of D*/
 			printf("B: Waiting... \n");
-			pid = wait(&status);	/*Father B waiting for his children to terminate*/
-			explain_wait_status(pid,status);	
+			wait_for_exited_pids(&pid, 1, EXIT_TIMEOUT_MS, 1);	/*Father B waiting for his children to terminate*/
 			printf("B: Exiting...\n");
 			exit(19);
 		}
+		kids[0] = pid;	/*B*/
 		pid = fork();
 		if (pid < 0) {
                 	perror("A: fork");
@@ -82,11 +82,9 @@ int main(void)
                         printf("C: Exiting...\n");
                         exit(17);
                         }	/*Father A of B-C*/
+		kids[1] = pid;	/*C*/
 		printf("A: Waiting... \n");
-		pid = wait(&status);	/*Father A waiting for his two children to terminate*/
-        	explain_wait_status(pid, status);
-		pid = wait(&status);
-                explain_wait_status(pid, status);
+		wait_for_exited_pids(kids, 2, EXIT_TIMEOUT_MS, 1);	/*Father A waiting for his two children to terminate*/
 		printf("A: Exiting...\n");
 		exit(16);
 	}
@@ -94,7 +92,6 @@ int main(void)
 	/* Print the process tree root at pid */
 	show_pstree(pid);
 	/* Wait for the root of the process tree (A) to terminate */
-	pid = wait(&status);
-	explain_wait_status(pid, status);
+	wait_for_exited_pids(&pid, 1, EXIT_TIMEOUT_MS, 1);
 	return 0;
 }
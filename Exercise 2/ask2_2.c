@@ -6,14 +6,18 @@
 #include <sys/wait.h>
 #include "proc-common.h"
 #include "tree.h"
+#include "workload.h"
 
 #define SLEEP_PROC_SEC  10
 #define SLEEP_TREE_SEC  3
+#define EXIT_TIMEOUT_MS 60000	/*a whole subtree must be done by then*/
+
+struct workload work = { WL_CPU, 0 };	/*-w: what every leaf does before sleeping, none by default*/
 
 pid_t make_proc_tree(struct tree_node *node)
 {
-	int status,i;
-	pid_t pid;
+	int i;
+	pid_t pid, *kids;
 	
 	pid = fork();
 	if (pid<0){	/*Error*/
@@ -24,9 +28,15 @@ pid_t make_proc_tree(struct tree_node *node)
 	if (pid==0){
 		change_pname(node->name);	/*Change the process name*/
 		printf("%s : Created \n", node->name);	/*Message "created"*/
+		kids = malloc(node->nr_children * sizeof(*kids));
+		if (node->nr_children && kids == NULL) {
+			fprintf(stderr, "%s: allocation failed\n", node->name);
+			exit(1);
+		}
 		for (i=0; i<node->nr_children; i++)
-			make_proc_tree(node->children+i);	/*recursion to create children*/
+			kids[i] = make_proc_tree(node->children+i);	/*recursion to create children*/
 		if (node->nr_children==0){			/*if leaf sleep*/
+			workload_run(work.profile, work.usec);
 			printf("%s: Sleeping...\n", node->name);
                         sleep(SLEEP_PROC_SEC);
                         printf("%s: Exiting...\n", node->name);
@@ -34,10 +44,7 @@ pid_t make_proc_tree(struct tree_node *node)
 		}
 		else {
 			printf("%s: Waiting...\n", node->name);	/*else procedure is father of other procedures*/
-			for(i=0; i<node->nr_children; i++){
-               			pid = wait(&status);    	/*Waiting for children to be terminated*/
-                		explain_wait_status(pid, status);
-                	}
+			wait_for_exited_pids(kids, node->nr_children, EXIT_TIMEOUT_MS, 1);	/*Waiting for children to be terminated*/
                		printf("%s: Exiting...\n", node->name);
                 	exit(0);
 		}
@@ -48,18 +55,26 @@ pid_t make_proc_tree(struct tree_node *node)
 int main(int argc, char *argv[])
 {
 	pid_t pid;
-	int status;
+	int opt;
 	struct tree_node *root;
-	if (argc != 2) {
-                fprintf(stderr, "Usage: %s <input_tree_file>\n\n", argv[0]);
+
+	while ((opt = getopt(argc, argv, "w:")) != -1) {
+		if (opt != 'w' || workload_parse(optarg, &work) < 0) {	/*profile:usec of work for every leaf*/
+			fprintf(stderr, "Usage: %s [-w cpu|mem|cache|io:usec] <input_tree_file>\n\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (optind != argc - 1) {
+                fprintf(stderr, "Usage: %s [-w cpu|mem|cache|io:usec] <input_tree_file>\n\n", argv[0]);
                 exit(1);
         }
-	root = get_tree_from_file(argv[1]);	/*get tree (tree_node)*/
+	root = get_tree_from_file(argv[optind]);	/*get tree (tree_node)*/
+	if (work.usec)
+		workload_calibrate(work.profile);	/*once, inherited by every node*/
 	pid = make_proc_tree(root);	/*returns pid of root (the first call of the function)*/
 	sleep(SLEEP_TREE_SEC); 	/*sleep until all procedures of tree created*/
         show_pstree(pid);	/* Print the process tree root at pid */
-        pid = wait(&status);	/* Wait for the root of the process tree to terminate */
-        explain_wait_status(pid, status);
+        wait_for_exited_pids(&pid, 1, EXIT_TIMEOUT_MS, 1);	/* Wait for the root of the process tree to terminate */
 	return 0;
 }
 
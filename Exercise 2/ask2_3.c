@@ -2,17 +2,55 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 #include "proc-common.h"
 #include "tree.h"
+#include "workload.h"
 
 #define SLEEP_PROC_SEC  10
 #define SLEEP_TREE_SEC  3
+#define READY_TIMEOUT_MS 60000	/*a whole subtree must be up by then*/
+#define THREAD_STACK_SIZE (64 * 1024)	/*a node thread only recurses once, keep stacks small*/
+
+struct workload work = { WL_CPU, 0 };	/*-w: what every node does once awake, none by default*/
+
+/*
+ * Thread-backed version of the tree (-t).
+ * Every node is a thread instead of a process. SIGSTOP/SIGCONT are replaced
+ * by two semaphores per node and wait() by pthread_join(), so the messages
+ * come out in exactly the same DFS order as with processes.
+ */
+struct thread_node {
+	struct tree_node   *node;
+	pthread_t          tid;
+	sem_t              ready;	/*posted when the node "raises SIGSTOP"*/
+	sem_t              cont;	/*posted by the father instead of SIGCONT*/
+};
+
+static long gettid_long(void)
+{
+	return (long)syscall(SYS_gettid);
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
 
 pid_t make_proc_tree(struct tree_node *node)
 {
-	int i,status;
+	int i;
+	struct child_state cs;
 	pid_t pid, *pid_child;
 	pid = fork();
 	if (pid<0){	/*Error*/
@@ -26,15 +64,18 @@ pid_t make_proc_tree(struct tree_node *node)
 		pid_child = (pid_t *)malloc((node->nr_children)*sizeof(pid_t));
 		for (i=0; i<node->nr_children; i++){
 			pid_child[i] = make_proc_tree(node->children+i); /*store in an array the pids of children*/
-			wait_for_ready_children(1);    /*Every process as a father waits for child to be ready (sigstop) before the next (DFS)*/
+			wait_for_ready_pids(&pid_child[i], 1, READY_TIMEOUT_MS);    /*Every process as a father waits for child to be ready (sigstop) before the next (DFS)*/
 		}
 		raise(SIGSTOP);	/*then stops until SIGCONT*/
                 printf("Name %s, PID = %ld is awake\n",node->name,(long)getpid());	/*SIGCONT - get's awake - message*/
+		workload_run(work.profile, work.usec);
 		for (i=0; i<node->nr_children; i++) {
 			pid = pid_child[i];
 			kill(pid,SIGCONT);	/*sends a SIGCONT message to every child*/
-			pid = wait(&status);	/*then waits for the child to terminate*/
-			explain_wait_status(pid, status);
+			if (wait_for_children(&pid, 1, CHILD_EXITED, -1, &cs))	/*then waits for that child to terminate*/
+				explain_wait_status(cs.pid, cs.status);
+			else
+				fprintf(stderr, "Child with PID %ld cannot be waited for\n", (long)pid);
 		}
 		printf("Name %s, PID = %ld, exiting... \n",node->name,(long)getpid());	/*and then exit*/
 		exit(0);
@@ -42,22 +83,115 @@ pid_t make_proc_tree(struct tree_node *node)
 	return pid;
 }
 
+static void *thread_node_main(void *arg);
+
+static void make_thread_tree(struct thread_node *tn, struct tree_node *node)
+{
+	int ret;
+	pthread_attr_t attr;
+
+	tn->node = node;
+	sem_init(&tn->ready, 0, 0);
+	sem_init(&tn->cont, 0, 0);
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+	ret = pthread_create(&tn->tid, &attr, thread_node_main, tn);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		printf("%s :",node->name);
+		fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+		exit(-1);
+	}
+}
+
+static void *thread_node_main(void *arg)
+{
+	int i;
+	struct thread_node *tn = arg, *tn_child;
+	struct tree_node *node = tn->node;
+
+	printf("Name %s, TID = %ld ,starting... \n",node->name,gettid_long());	/*message for starting*/
+	prctl(PR_SET_NAME, node->name);	/*change thread name, for show_pstree_threads()*/
+	tn_child = malloc((node->nr_children)*sizeof(struct thread_node));
+	for (i=0; i<node->nr_children; i++){
+		make_thread_tree(tn_child+i, node->children+i);
+		sem_wait(&tn_child[i].ready);	/*wait for the child subtree to be ready before the next (DFS)*/
+	}
+	sem_post(&tn->ready);	/*"raise(SIGSTOP)"*/
+	sem_wait(&tn->cont);	/*until the father "sends SIGCONT"*/
+	printf("Name %s, TID = %ld is awake\n",node->name,gettid_long());
+	workload_run(work.profile, work.usec);
+	for (i=0; i<node->nr_children; i++) {
+		sem_post(&tn_child[i].cont);	/*wake every child*/
+		pthread_join(tn_child[i].tid, NULL);	/*then wait for it to terminate*/
+		fprintf(stderr, "My TID = %ld: Child %s terminated normally, exit status = 0\n",
+			gettid_long(), tn_child[i].node->name);
+		sem_destroy(&tn_child[i].ready);
+		sem_destroy(&tn_child[i].cont);
+	}
+	free(tn_child);
+	printf("Name %s, TID = %ld, exiting... \n",node->name,gettid_long());
+	return NULL;
+}
+
 int main(int argc, char *argv[])
 {
 	pid_t pid;
-	int status;
+	int opt, threads = 0;
+	struct child_state cs;
+	double t_start, t_ready, t_wake, t_done;
 	struct tree_node *root;
-	if (argc < 2) {
-                fprintf(stderr, "Usage: %s <input_tree_file>\n\n", argv[0]);
+	struct thread_node troot;
+
+	while ((opt = getopt(argc, argv, "tw:")) != -1) {
+		switch (opt) {
+		case 't':	/*nodes are threads, not processes*/
+			threads = 1;
+			break;
+		case 'w':	/*profile:usec of work for every node*/
+			if (workload_parse(optarg, &work) == 0)
+				break;
+			/* fall through */
+		default:
+			fprintf(stderr, "Usage: %s [-t] [-w cpu|mem|cache|io:usec] <input_tree_file>\n\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (optind >= argc) {
+                fprintf(stderr, "Usage: %s [-t] [-w cpu|mem|cache|io:usec] <input_tree_file>\n\n", argv[0]);
                 exit(1);
         }
-	root = get_tree_from_file(argv[1]);	/*get tree (tree_node)*/
-	pid = make_proc_tree(root);	/*returns pid of root*/
-	wait_for_ready_children(1);	/*wait for root process to be ready*/
-	show_pstree(pid);	/* Print the process tree root at pid */
-	kill(pid,SIGCONT);	/*send SIGCONT to root*/
-        pid = wait(&status);	/* Wait for the root of the process tree to terminate */
-        explain_wait_status(pid, status);
+	root = get_tree_from_file(argv[optind]);	/*get tree (tree_node)*/
+	if (work.usec)
+		workload_calibrate(work.profile);	/*once, inherited by every node*/
+	if (threads) {
+		t_start = now_ms();
+		make_thread_tree(&troot, root);
+		sem_wait(&troot.ready);	/*wait for root thread to be ready*/
+		t_ready = now_ms();
+		show_pstree_threads(getpid());	/*node threads show up as {name} under us*/
+		t_wake = now_ms();
+		sem_post(&troot.cont);
+		pthread_join(troot.tid, NULL);
+		t_done = now_ms();
+	} else {
+		t_start = now_ms();
+		pid = make_proc_tree(root);	/*returns pid of root*/
+		wait_for_ready_pids(&pid, 1, READY_TIMEOUT_MS);	/*wait for root process to be ready*/
+		t_ready = now_ms();
+		show_pstree(pid);	/* Print the process tree root at pid */
+		t_wake = now_ms();
+		kill(pid,SIGCONT);	/*send SIGCONT to root*/
+		if (!wait_for_children(&pid, 1, CHILD_EXITED, -1, &cs)) {	/* Wait for the root of the process tree to terminate */
+			fprintf(stderr, "Root with PID %ld cannot be waited for\n", (long)pid);
+			exit(1);
+		}
+		t_done = now_ms();
+		explain_wait_status(cs.pid, cs.status);
+	}
+	/*pstree time is not counted, only creation and the wake/exit cascade*/
+	fprintf(stderr, "%s: create %.3f ms, wake/exit %.3f ms\n",
+		threads ? "threads" : "processes", t_ready - t_start, t_done - t_wake);
 	return 0;
 }
 
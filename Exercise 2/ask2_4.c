@@ -2,20 +2,166 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include "proc-common.h"
 #include "tree.h"
+#include "expr.h"
+#include "expr-bc.h"
 
 #define SLEEP_PROC_SEC  10
 #define SLEEP_TREE_SEC  3
+#define VAL_BUF_SIZE    32
+#define BENCH_RUNS      5
+#define GEN_MAX_CHILDREN 4	/*fanout of -g expressions*/
+#define SERVER_ARENA_BYTES (64 << 20)	/*room for the expressions of -S*/
+#define SERVER_MAX_JOBS  1024
+#define SERVER_JOBS_PER_WORKER 4
+#define SERVER_MIN_INSNS 256	/*smaller expressions are not worth waking the workers*/
+#define SERVER_TIMEOUT_MS 10000	/*a worker that has not stopped by then is stuck*/
+#define EXIT_TIMEOUT_MS  60000	/*a node must exit this long after its father is done with it*/
+#define SLOT_POLL_MS     100	/*how often a father waiting on a slot looks if the child is still there*/
 
-pid_t make_proc_tree(struct tree_node *node, int fd_father[2])
+/*messages only when not quiet (-q) or benchmarking (-B)*/
+#define say(...) \
+	do { if (verbose) printf(__VA_ARGS__); } while (0)
+
+/*
+ * With -s results do not travel over pipes: every node has a slot in one
+ * shared memory area, indexed by its DFS (preorder) number. A child fills in
+ * its slot and publishes it with a release store of ->ready, the father sleeps
+ * on ->ready with a futex. A child that dies before publishing never wakes the
+ * father, so he wakes up every SLOT_POLL_MS to look for it.
+ */
+struct result_slot {
+	int               ready;
+	int               err;
+	union expr_value  val;
+};
+
+enum transport { T_PIPE, T_SHM };
+
+enum expr_type type = EXPR_INT64;	/*type of all operands, -d for double*/
+unsigned cutoff = 0;	/*subtrees with up to cutoff nodes are evaluated without forking*/
+int verbose = 1;
+enum transport transport = T_PIPE;
+struct result_slot *slots;	/*T_SHM: one per node*/
+unsigned *sizes;	/*subtree size of every node, by DFS number*/
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void slot_publish(struct result_slot *slot, int err, union expr_value val)
+{
+	slot->err = err;
+	slot->val = val;
+	__atomic_store_n(&slot->ready, 1, __ATOMIC_RELEASE);	/*err and val are visible before ready*/
+	syscall(SYS_futex, &slot->ready, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*returns -1 if the child exited without filling in its slot*/
+static int slot_wait(struct result_slot *slot, pid_t child)
+{
+	struct timespec ts = { 0, SLOT_POLL_MS * 1000000L };
+	siginfo_t si;
+
+	while (!__atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE)) {
+		if (syscall(SYS_futex, &slot->ready, FUTEX_WAIT, 0, &ts, NULL, 0) == 0 || errno != ETIMEDOUT)
+			continue;
+		si.si_pid = 0;	/*WNOWAIT: it is still reaped with the others*/
+		if (waitid(P_PID, child, &si, WEXITED | WNOHANG | WNOWAIT) < 0 || si.si_pid == child)
+			return __atomic_load_n(&slot->ready, __ATOMIC_ACQUIRE) ? 0 : -1;
+	}
+	return 0;
+}
+
+/*
+ * Send the result of a node (or the error that stopped it) to the father.
+ * All the children of a node share one pipe, every message carries the index
+ * of the child and is smaller than PIPE_BUF, so writes never interleave.
+ * With -s the result goes to the slot of the node instead.
+ */
+static void send_result(struct tree_node *node, int fd, unsigned idx, unsigned id, int err, union expr_value val)
+{
+	char buf[VAL_BUF_SIZE];
+	struct expr_msg msg;
+	const char *where = (transport == T_SHM) ? "slot" : "pipe";
+
+	if (err)
+		say("%s: %d sends error \"%s\" to %s \n", node->name, getpid(), expr_strerror(err), where);
+	else
+		say("%s: %d sends %s to %s \n", node->name, getpid(), expr_format(buf, sizeof(buf), type, val), where);
+	if (transport == T_SHM) {
+		slot_publish(&slots[id], err, val);
+		return;
+	}
+	msg.idx = idx;
+	msg.err = err;
+	msg.val = val;
+	if (write(fd, &msg, sizeof(msg)) != sizeof(msg)) {	/*send the result to the pipe of the father*/
+		perror("write pipe");
+		exit(-1);
+	}
+}
+
+/*store the result of a child, keeping the first error*/
+static void take_result(struct tree_node *node, union expr_value *vals, struct expr_msg *msg, int *err)
+{
+	char buf[VAL_BUF_SIZE];
+
+	assert(msg->idx < node->nr_children);
+	if (msg->err && !*err)
+		*err = msg->err;
+	vals[msg->idx] = msg->val;
+	if (!msg->err)
+		say("%s : %d reads %s from child %u \n", node->name, getpid(),
+			expr_format(buf, sizeof(buf), type, msg->val), msg->idx);
+}
+
+/*fill in sizes[] for the subtree of node, which has DFS number id*/
+static unsigned number_tree(struct tree_node *node, unsigned id)
+{
+	unsigned i, size = 1;
+
+	for (i=0; i<node->nr_children; i++)
+		size += number_tree(node->children+i, id+size);
+	sizes[id] = size;
+	return size;
+}
+
+/*is this subtree worth a process of its own?*/
+static int worth_forking(struct tree_node *node)
+{
+	return expr_tree_size_upto(node, cutoff) > cutoff;
+}
+
+/*
+ * Fork the process of node, which is child idx of its father and has DFS number id.
+ * fd_father is the pipe shared by all children of the father,
+ * fd_up the father's own write end, which the child has no use for.
+ * With -s there are no pipes and both are -1.
+ * Children with small subtrees are evaluated right here instead of forking.
+ */
+pid_t make_proc_tree(struct tree_node *node, unsigned idx, unsigned id, int fd_father[2], int fd_up)
 {	
-	int fd1[2], fd2[2];
-	int status;
-	pid_t pid;
-	int num1, num2;
+	int fd[2] = { -1, -1 };
+	int err;
+	unsigned i, got, forked, cid;
+	pid_t pid, *kids;
+	struct expr_msg msg;
+	union expr_value res, *vals;
+
+	fflush(stdout);	/*or the child prints our buffered output again*/
 	pid = fork();
 	if (pid<0){	/*Error*/
 		printf("%s :",node->name);
@@ -23,95 +169,580 @@ pid_t make_proc_tree(struct tree_node *node, int fd_father[2])
 		exit(-1);
 	}
 	if (pid==0){
+		if (fd_father[0] >= 0)
+			close(fd_father[0]);	/*only the father reads*/
+		if (fd_up >= 0)
+			close(fd_up);
 		change_pname(node->name);	/*Change the process name*/
-		printf("%s : Created \n", node->name);	/*Message "created"*/
-		if (node->nr_children==0){	/*it's a leaf*/                     
-                        num1 = atoi(node->name);
-                        printf("%s: %d sends %d to pipe \n", node->name,getpid(),num1);
-                        if (write(fd_father[1],&num1,sizeof(num1))<0){	/*sends the number (name) to father*/
-				perror("write pipe");
-				exit(-1);
-			}
-                        sleep(SLEEP_PROC_SEC);
-                        printf("%s: Exiting...\n", node->name);	/*then sleeps because we want to see the tree*/
+		say("%s : Created \n", node->name);	/*Message "created"*/
+		if (node->nr_children==0){	/*it's a leaf*/
+			err = expr_leaf_value(node->name, type, &res);
+			send_result(node, fd_father[1], idx, id, err, res);	/*sends the number (name) to father*/
+			if (verbose)
+				sleep(SLEEP_PROC_SEC);	/*then sleeps because we want to see the tree*/
+                        say("%s: Exiting...\n", node->name);
                         exit(0);
-                }		
-		if (pipe(fd1)){
-                	perror ("pipe");	/*create a pipe for the first child*/
+                }
+		if (!worth_forking(node)){	/*small subtree, no children processes at all*/
+			err = expr_eval_local(node, type, &res);
+			send_result(node, fd_father[1], idx, id, err, res);
+			say("%s: Exiting...\n", node->name);
+			exit(0);
+		}
+		if (transport == T_PIPE && pipe(fd)){
+                	perror ("pipe");	/*one pipe for all the children*/
                 	exit(-1);
        		}
-		make_proc_tree(node->children, fd1);	/*recursion*/
-		if (pipe(fd2)){
-                        perror ("pipe");	/*create a second pipe for the second child*/
-                        exit(-1);
-                }
-                make_proc_tree(node->children+1, fd2);	/*recursion*/
-		printf("%s: Waiting...\n", node->name);	/*else procedure is father of other procedures*/
-		pid = wait(&status);            /*Waiting for children to be terminated*/
- 		explain_wait_status(pid, status);
-       	        pid = wait(&status);            /*Waiting for children to be terminated*/
-              	explain_wait_status(pid, status);
-		if (read(fd1[0],&num1,sizeof(num1)) <0){	/*read from pipe1 the value of the first child*/
-                                perror("read pipe");
-                                exit(-1);
-                        }
-		if (read(fd2[0],&num2,sizeof(num2)) <0){	/*read from pipe2 the value of the second child*/
-                                perror("read pipe");
-                                exit(-1);
-                        }
-		printf("%s : %d reads %d and %d from pipe \n" , node->name, getpid(),num1,num2);
-		printf("%d : %d %s %d \n",getpid(), num1, node->name, num2);
-		switch(node->name[0]){	/*choose operation*/
-			case '+':
-				num1 = num1+num2;
-				break;
-			case '-':
-				num1 = num1-num2;
-				break;
-			case '/':
-				num1 = num1/num2;
-				break;
-			case '*':
-				num1 = num1*num2;
-				break;
+		kids = malloc(node->nr_children*sizeof(*kids));
+		if (kids == NULL) {
+			fprintf(stderr, "%s: allocation failed\n", node->name);
+			exit(-1);
 		}
-		printf("%s: %d sends %d to pipe \n",node->name,getpid(),num1);
-		if (write(fd_father[1],&num1,sizeof(num1))<0){	/*send the result to the pipe of the father*/
-                                perror("write pipe");
-                                exit(-1);
-                        }
-      		printf("%s: Exiting...\n", node->name);
+		forked = 0;
+		for (i=0, cid=id+1; i<node->nr_children; cid+=sizes[cid], i++)
+			if (worth_forking(node->children+i))
+				kids[forked++] = make_proc_tree(node->children+i, i, cid, fd, fd_father[1]);	/*recursion*/
+		if (transport == T_PIPE)
+			close(fd[1]);
+		vals = malloc(node->nr_children*sizeof(*vals));
+		if (vals == NULL) {
+			fprintf(stderr, "%s: allocation failed\n", node->name);
+			exit(-1);
+		}
+		err = EXPR_OK;
+		for (i=0; i<node->nr_children; i++)	/*small children, while the big ones run*/
+			if (!worth_forking(node->children+i) && !err)
+				err = expr_eval_local(node->children+i, type, vals+i);
+		say("%s: Waiting...\n", node->name);	/*else procedure is father of other procedures*/
+		if (transport == T_SHM){
+			for (i=0, got=0, cid=id+1; i<node->nr_children; cid+=sizes[cid], i++){
+				if (!worth_forking(node->children+i))
+					continue;
+				if (slot_wait(&slots[cid], kids[got++]) < 0){	/*like EOF on the pipe*/
+					fprintf(stderr, "%s: child %u died without a result\n", node->name, i);
+					exit(-1);
+				}
+				msg.idx = i;
+				msg.err = slots[cid].err;
+				msg.val = slots[cid].val;
+				take_result(node, vals, &msg, &err);
+			}
+		} else {
+			for (got=0; got<forked; got++){	/*results come in any order, idx puts them in place*/
+				if (read(fd[0],&msg,sizeof(msg)) != sizeof(msg)){
+                                	perror("read pipe");
+                                	exit(-1);
+                        	}
+				take_result(node, vals, &msg, &err);
+			}
+			close(fd[0]);
+		}
+		wait_for_exited_pids(kids, forked, EXIT_TIMEOUT_MS, verbose);	/*Waiting for children to be terminated*/
+		if (!err)
+			err = expr_fold(node, type, vals, &res);	/*apply the operator to all children*/
+		free(vals);
+		free(kids);
+		send_result(node, fd_father[1], idx, id, err, res);
+      		say("%s: Exiting...\n", node->name);
         	exit(0);
 	}
 	return pid;
         }
 
-int main(int argc, char *argv[])
+/*number of processes make_proc_tree() creates for the current cutoff*/
+static unsigned count_procs(struct tree_node *node)
+{
+	unsigned i, n = 1;
+
+	if (!worth_forking(node))
+		return n;
+	for (i=0; i<node->nr_children; i++)
+		if (worth_forking(node->children+i))
+			n += count_procs(node->children+i);
+	return n;
+}
+
+/*fork the tree for root and collect its result*/
+static struct expr_msg eval_tree(struct tree_node *root)
 {
-	int fd[2]; /*pipe*/
-        int num1;
+	int fd[2] = { -1, -1 }; /*pipe*/
 	pid_t pid;
-	int status;
-	struct tree_node *root;
-	if (argc != 2) {
-                fprintf(stderr, "Usage: %s <input_tree_file>\n\n", argv[0]);
-                exit(1);
-        }
-	root = get_tree_from_file(argv[1]);	/*get tree (tree_node)*/
-	if (pipe(fd))
+	struct expr_msg msg;
+
+	if (transport == T_SHM)
+		memset(slots, 0, sizes[0]*sizeof(*slots));	/*all slots empty again*/
+	else if (pipe(fd))
     	{
       		perror ("pipe");
-      		return EXIT_FAILURE;
+      		exit(EXIT_FAILURE);
     	}
-	pid = make_proc_tree(root,fd);	/*returns pid of root (the first call of the function)*/
-	sleep(SLEEP_TREE_SEC); 	/*sleep until all procedures of tree created*/
-        show_pstree(pid);	/* Print the process tree root at pid */
-	pid = wait(&status);    /* Wait for the root of the process tree to terminate */
-        explain_wait_status(pid, status);
-	if (read(fd[0],&num1,sizeof(num1)) <0 ){	/*read the result from pipe (from tree's root)*/
+	pid = make_proc_tree(root, 0, 0, fd, -1);	/*returns pid of root (the first call of the function)*/
+	if (transport == T_PIPE)
+		close(fd[1]);
+	if (verbose) {
+		sleep(SLEEP_TREE_SEC); 	/*sleep until all procedures of tree created*/
+		show_pstree(pid);	/* Print the process tree root at pid */
+	}
+	if (transport == T_SHM) {
+		if (slot_wait(&slots[0], pid) < 0) {	/*the root's result*/
+			fprintf(stderr, "root died without a result\n");
+			exit(1);
+		}
+		msg.idx = 0;
+		msg.err = slots[0].err;
+		msg.val = slots[0].val;
+	} else {
+		if (read(fd[0],&msg,sizeof(msg)) != sizeof(msg)){	/*read the result from pipe (from tree's root)*/
                                 perror("read pipe");
                                 exit(-1);
                         }
-	printf("##################### \nThe result is : %d \n#####################\n",num1);
+		close(fd[0]);
+	}
+	wait_for_exited_pids(&pid, 1, EXIT_TIMEOUT_MS, verbose);	/* Wait for the root of the process tree to terminate */
+	return msg;
+}
+
+/*average time of one evaluation with the current cutoff and transport*/
+static double time_eval(struct tree_node *root)
+{
+	int r;
+	double t;
+
+	t = now_ms();
+	for (r = 0; r < BENCH_RUNS; r++)
+		eval_tree(root);
+	return (now_ms() - t) / BENCH_RUNS;
+}
+
+/*
+ * Sweep the cutoff from "fork every node" to "evaluate everything in the root",
+ * showing the price of a fork against the parallelism it buys,
+ * once with pipes and once with shared memory slots.
+ */
+static void bench_cutoff(struct tree_node *root)
+{
+	unsigned size = sizes[0];
+	unsigned c;
+	int last = 0;
+	double t_pipe, t_shm;
+
+	printf("%10s %10s %14s %14s\n", "cutoff", "procs", "pipe ms/eval", "shm ms/eval");
+	for (c = cutoff; !last; c = c ? 2*c : 1) {
+		if (c >= size) {
+			c = size;
+			last = 1;
+		}
+		cutoff = c;
+		transport = T_PIPE;
+		t_pipe = time_eval(root);
+		transport = T_SHM;
+		t_shm = time_eval(root);
+		printf("%10u %10u %14.3f %14.3f\n", c, count_procs(root), t_pipe, t_shm);
+		fflush(stdout);
+	}
+}
+
+/*
+ * The baseline for all of the above: no processes at all, one pass over
+ * the compiled DAG, then the same with nr_threads threads, level by level.
+ */
+static void bench_bytecode(struct tree_node *root, unsigned nr_threads)
+{
+	struct bc_prog *prog;
+	struct bc_pool *pool;
+	union expr_value res;
+	int r, err;
+	double t, t_seq, t_par;
+
+	t = now_ms();
+	prog = bc_compile(root, type, 1, &err);
+	t = now_ms() - t;
+	if (prog == NULL) {
+		printf("bytecode: %s\n", expr_strerror(err));
+		return;
+	}
+	printf("\nbytecode: %u nodes -> %u instructions, %u levels, compiled in %.3f ms\n",
+		prog->nr_nodes, prog->nr_insns, prog->nr_levels, t);
+
+	t = now_ms();
+	for (r = 0; r < BENCH_RUNS; r++)
+		bc_eval(prog, &res);
+	t_seq = (now_ms() - t) / BENCH_RUNS;
+
+	pool = bc_pool_create(nr_threads);
+	t = now_ms();
+	for (r = 0; r < BENCH_RUNS; r++)
+		bc_eval_parallel(pool, prog, &res);
+	t_par = (now_ms() - t) / BENCH_RUNS;
+	bc_pool_destroy(pool);
+
+	printf("%10s %3u %s %12.3f ms/eval\n", "", 1, "thread ", t_seq);
+	printf("%10s %3u %s %12.3f ms/eval\n", "", nr_threads, "threads", t_par);
+	bc_free(prog);
+}
+
+/*evaluate with -C, in this process*/
+static struct expr_msg eval_bytecode(struct tree_node *root, unsigned nr_threads)
+{
+	struct bc_prog *prog;
+	struct bc_pool *pool;
+	struct expr_msg msg;
+
+	msg.idx = 0;
+	prog = bc_compile(root, type, 1, &msg.err);
+	if (prog == NULL)
+		return msg;
+	say("compiled %u nodes to %u instructions in %u levels\n",
+		prog->nr_nodes, prog->nr_insns, prog->nr_levels);
+	if (nr_threads > 1) {
+		pool = bc_pool_create(nr_threads);
+		msg.err = bc_eval_parallel(pool, prog, &msg.val);
+		bc_pool_destroy(pool);
+	} else {
+		msg.err = bc_eval(prog, &msg.val);
+	}
+	bc_free(prog);
+	return msg;
+}
+
+/*
+ * Server mode (-S workers): the workers are forked once, before any expression
+ * is read, and wait stopped with raise(SIGSTOP) like the nodes of ask2_3.
+ * For every expression on stdin the father compiles it (without deduplication,
+ * so that every subtree is a contiguous range of instructions) into arrays
+ * allocated from a shared memory arena and freed after it, so the next
+ * expression of a similar size reuses them; one that does not fit is
+ * evaluated by the father alone. He cuts the expression into subtree jobs, wakes the workers with SIGCONT and
+ * takes jobs himself too. A worker that finds the queue empty stops again, so
+ * once all of them are stopped every job is done and the father evaluates the
+ * few instructions above the jobs.
+ */
+struct server_job {
+	unsigned  lo, hi;	/*instructions lo .. hi-1, a whole subtree*/
+	int       err;
+};
+
+struct server_shm {
+	int                quit;
+	unsigned           nr_jobs;
+	unsigned           next_job;	/*taken with an atomic add*/
+	struct bc_prog     prog;	/*arrays point to the ones below*/
+	struct server_job  job[SERVER_MAX_JOBS];
+};
+
+static void server_take_jobs(struct server_shm *shm)
+{
+	unsigned j;
+
+	while ((j = __atomic_fetch_add(&shm->next_job, 1, __ATOMIC_ACQ_REL)) < shm->nr_jobs)
+		shm->job[j].err = bc_eval_range(&shm->prog, shm->job[j].lo, shm->job[j].hi);
+}
+
+static void server_worker(struct server_shm *shm)
+{
+	change_pname("worker");
+	for (;;) {
+		raise(SIGSTOP);	/*idle until the next expression*/
+		if (shm->quit)
+			exit(0);
+		server_take_jobs(shm);
+	}
+}
+
+/*wait until all workers have stopped, without a message for every one*/
+static void server_wait_stopped(pid_t *workers, unsigned nr_workers)
+{
+	unsigned i;
+	struct child_state *res;
+
+	res = malloc(nr_workers * sizeof(*res));
+	if (!res) {
+		perror("malloc");
+		exit(1);
+	}
+	if (wait_for_children(workers, nr_workers, CHILD_STOPPED, SERVER_TIMEOUT_MS, res) == (int)nr_workers) {
+		free(res);
+		return;
+	}
+	for (i = 0; i < nr_workers; i++) {
+		if (res[i].state == CHILD_EXITED) {
+			explain_wait_status(res[i].pid, res[i].status);
+			continue;
+		}
+		if (res[i].state == CHILD_RUNNING)
+			fprintf(stderr, "Server: worker %ld did not stop within %d ms\n",
+				(long)res[i].pid, SERVER_TIMEOUT_MS);
+		else if (res[i].state == CHILD_LOST)
+			fprintf(stderr, "Server: worker %ld cannot be waited for\n", (long)res[i].pid);
+		kill(res[i].pid, SIGKILL);	/*don't leave the rest of the pool behind*/
+	}
+	fprintf(stderr, "Server: giving up on the worker pool.\n");
+	exit(1);
+}
+
+/*
+ * Cover the subtree of instruction i with jobs of at most grain instructions.
+ * size[] is the subtree size of every instruction.
+ */
+static int server_split(struct server_shm *shm, unsigned *size, unsigned i, unsigned grain)
+{
+	struct bc_insn *in = shm->prog.insn + i;
+	unsigned k;
+
+	if (size[i] <= grain || in->nargs == 0) {
+		if (shm->nr_jobs == SERVER_MAX_JOBS)
+			return -1;
+		shm->job[shm->nr_jobs].lo = i + 1 - size[i];
+		shm->job[shm->nr_jobs].hi = i + 1;
+		shm->job[shm->nr_jobs].err = EXPR_OK;
+		shm->nr_jobs++;
+		return 0;
+	}
+	for (k = 0; k < in->nargs; k++)
+		if (server_split(shm, size, shm->prog.argv[in->args + k], grain))
+			return -1;
+	return 0;
+}
+
+static struct expr_msg server_eval(struct server_shm *shm, struct shm_arena *arena,
+	pid_t *workers, unsigned nr_workers, struct tree_node *root)
+{
+	struct bc_prog *prog;
+	struct expr_msg msg;
+	shm_off_t insn, argv, vals;
+	unsigned i, k, cur, *size;
+
+	msg.idx = 0;
+	prog = bc_compile(root, type, 0, &msg.err);
+	if (prog == NULL)
+		return msg;
+	insn = shm_arena_alloc(arena, prog->nr_insns * sizeof(*prog->insn));
+	argv = shm_arena_alloc(arena, prog->nr_argv * sizeof(*prog->argv));
+	vals = shm_arena_alloc(arena, prog->nr_insns * sizeof(*prog->vals));
+	if (!insn || !argv || !vals) {
+		shm_arena_free(arena, insn);
+		shm_arena_free(arena, argv);
+		shm_arena_free(arena, vals);
+		msg.err = bc_eval(prog, &msg.val);	/*does not fit, do it ourselves*/
+		bc_free(prog);
+		return msg;
+	}
+	shm->prog = *prog;
+	shm->prog.insn = shm_arena_ptr(arena, insn);
+	shm->prog.argv = shm_arena_ptr(arena, argv);
+	shm->prog.vals = shm_arena_ptr(arena, vals);
+	memcpy(shm->prog.insn, prog->insn, prog->nr_insns * sizeof(*prog->insn));
+	memcpy(shm->prog.argv, prog->argv, prog->nr_argv * sizeof(*prog->argv));
+	shm->prog.by_level = NULL;	/*only for bc_eval_parallel()*/
+	shm->prog.level_start = NULL;
+	bc_free(prog);
+	prog = &shm->prog;
+
+	shm->nr_jobs = 0;
+	if (prog->nr_insns >= SERVER_MIN_INSNS) {
+		size = malloc(prog->nr_insns * sizeof(*size));
+		if (size == NULL) {
+			fprintf(stderr, "Server: allocation failed\n");
+			exit(1);
+		}
+		for (i = 0; i < prog->nr_insns; i++) {
+			size[i] = 1;
+			for (k = 0; k < prog->insn[i].nargs; k++)
+				size[i] += size[prog->argv[prog->insn[i].args + k]];
+		}
+		if (server_split(shm, size, prog->nr_insns - 1,
+				prog->nr_insns / (nr_workers * SERVER_JOBS_PER_WORKER) + 1))
+			shm->nr_jobs = 0;	/*too many jobs, no workers then*/
+		free(size);
+	}
+
+	if (shm->nr_jobs > 0) {
+		shm->next_job = 0;
+		for (i = 0; i < nr_workers; i++)
+			kill(workers[i], SIGCONT);
+		server_take_jobs(shm);
+		server_wait_stopped(workers, nr_workers);
+	}
+
+	/*
+	 * Jobs are in postfix order too. What is left between them
+	 * are the ancestors of the jobs before, in the right order.
+	 */
+	msg.err = EXPR_OK;
+	for (i = 0, cur = 0; i <= shm->nr_jobs && !msg.err; i++) {
+		k = (i < shm->nr_jobs) ? shm->job[i].lo : prog->nr_insns;
+		msg.err = bc_eval_range(prog, cur, k);
+		if (i < shm->nr_jobs) {
+			if (!msg.err)
+				msg.err = shm->job[i].err;
+			cur = shm->job[i].hi;
+		}
+	}
+	msg.val = prog->vals[prog->nr_insns - 1];
+	shm_arena_free(arena, insn);
+	shm_arena_free(arena, argv);
+	shm_arena_free(arena, vals);
+	return msg;
+}
+
+/*
+ * Read expressions (trees in the usual file format, one after the other)
+ * from stdin until EOF and print one result per line.
+ */
+static void server(unsigned nr_workers)
+{
+	struct server_shm *shm;
+	struct shm_arena *arena;
+	struct tree_node *root;
+	struct expr_msg msg;
+	pid_t *workers;
+	unsigned i, nr_exprs = 0;
+	double t;
+	char buf[VAL_BUF_SIZE];
+
+	if (nr_workers < 1)
+		nr_workers = 1;
+	if (nr_workers * SERVER_JOBS_PER_WORKER > SERVER_MAX_JOBS)
+		nr_workers = SERVER_MAX_JOBS / SERVER_JOBS_PER_WORKER;
+	shm = create_shared_memory_area(sizeof(*shm));
+	arena = shm_arena_create(SERVER_ARENA_BYTES, SHM_ARENA_THP);
+	workers = malloc(nr_workers * sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Server: allocation failed\n");
+		exit(1);
+	}
+	for (i = 0; i < nr_workers; i++) {
+		fflush(stdout);
+		workers[i] = fork();
+		if (workers[i] < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (workers[i] == 0)
+			server_worker(shm);
+	}
+	server_wait_stopped(workers, nr_workers);
+
+	t = now_ms();
+	while ((root = get_tree_from_stream(stdin)) != NULL) {
+		msg = server_eval(shm, arena, workers, nr_workers, root);
+		free_tree(root);
+		if (msg.err)
+			printf("error: %s\n", expr_strerror(msg.err));
+		else
+			printf("%s\n", expr_format(buf, sizeof(buf), type, msg.val));
+		nr_exprs++;
+	}
+	t = now_ms() - t;
+
+	shm->quit = 1;
+	for (i = 0; i < nr_workers; i++)
+		kill(workers[i], SIGCONT);
+	wait_for_exited_pids(workers, nr_workers, SERVER_TIMEOUT_MS, 0);
+	fflush(stdout);
+	fprintf(stderr, "Server: %u expressions in %.3f ms, %.1f expressions/s with %u workers\n",
+		nr_exprs, t, t > 0 ? nr_exprs * 1000.0 / t : 0.0, nr_workers);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d] [-q] [-s] [-c cutoff] [-C] [-j threads] [-B] <input_tree_file>\n"
+		"       %s [options] -g nodes\n"
+		"       %s [-d] -S workers < expressions\n"
+		"  -d         double operands instead of 64-bit integers\n"
+		"  -q         quiet, no messages and no sleeping\n"
+		"  -s         results in shared memory slots instead of pipes\n"
+		"  -c cutoff  evaluate subtrees of up to cutoff nodes in the father\n"
+		"             (with -B, the first cutoff of the sweep)\n"
+		"  -C         no processes, compile to bytecode and evaluate that\n"
+		"  -j threads evaluate the bytecode with this many threads\n"
+		"  -g nodes   a random expression of this many nodes instead of a file\n"
+		"  -B         benchmark a sweep of cutoffs, pipes against slots,\n"
+		"             and the bytecode\n"
+		"  -S workers serve expressions from stdin with pre-forked workers\n\n", prog, prog, prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, bench = 0, bytecode = 0;
+	unsigned nr_threads = 1, gen_nodes = 0, nr_workers = 0;
+	struct tree_node *root;
+	struct expr_msg msg;
+	char buf[VAL_BUF_SIZE];
+
+	while ((opt = getopt(argc, argv, "dqsc:Cj:g:BS:")) != -1) {
+		switch (opt) {
+		case 'd':
+			type = EXPR_DOUBLE;
+			break;
+		case 'q':
+			verbose = 0;
+			break;
+		case 's':
+			transport = T_SHM;
+			break;
+		case 'c':
+			cutoff = strtoul(optarg, NULL, 10);
+			break;
+		case 'C':
+			bytecode = 1;
+			break;
+		case 'j':
+			nr_threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'g':
+			gen_nodes = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			nr_workers = strtoul(optarg, NULL, 10);
+			break;
+		case 'B':
+			bench = 1;
+			verbose = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_workers) {
+		if (optind != argc)
+			usage(argv[0]);
+		server(nr_workers);
+		return 0;
+	}
+	if (optind != argc - (gen_nodes ? 0 : 1))
+		usage(argv[0]);
+	if (gen_nodes)
+		root = expr_random_tree(gen_nodes, GEN_MAX_CHILDREN, 1);
+	else
+		root = get_tree_from_file(argv[optind]);	/*get tree (tree_node)*/
+	if (root == NULL) {
+		fprintf(stderr, "empty tree\n");
+		exit(1);
+	}
+	sizes = malloc(expr_tree_size(root)*sizeof(*sizes));
+	if (sizes == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		exit(1);
+	}
+	number_tree(root, 0);
+	if (transport == T_SHM || bench)
+		slots = create_shared_memory_area(sizes[0]*sizeof(*slots));
+	if (bench) {
+		bench_cutoff(root);
+		bench_bytecode(root, nr_threads > 1 ? nr_threads : sysconf(_SC_NPROCESSORS_ONLN));
+		return 0;
+	}
+	if (bytecode)
+		msg = eval_bytecode(root, nr_threads);
+	else
+		msg = eval_tree(root);
+	if (msg.err) {
+		printf("##################### \nError: %s \n#####################\n", expr_strerror(msg.err));
+		return 1;
+	}
+	printf("##################### \nThe result is : %s \n#####################\n",
+		expr_format(buf, sizeof(buf), type, msg.val));
 	return 0;
 }
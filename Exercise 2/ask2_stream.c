@@ -0,0 +1,497 @@
+#define _GNU_SOURCE	/*close_range()*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "proc-common.h"
+#include "tree.h"
+#include "expr.h"
+
+/*
+ * Streaming version of ask2_4: the same process tree evaluates the expression
+ * over columns of numbers instead of a single value.
+ *
+ * A leaf is either a number, which is used for every row, or the name of a
+ * column file: one number per line, or raw doubles if the name ends in ".bin".
+ * Subtrees of numbers only are folded into one number before anything forks.
+ * Every other node is a process that reads one batch of rows from each child,
+ * combines them and sends the batch on, so the whole tree works like a pipeline.
+ * The root's batches are printed as soon as they arrive.
+ */
+
+#define BATCH_ROWS      1024	/*rows per batch, 8KB of doubles*/
+#define LINE_SIZE       128
+#define EXIT_TIMEOUT_MS 10000	/*after the end of its stream a process has only to exit*/
+
+/*what travels over the pipes: a row count, then that many doubles (0 rows = end)*/
+struct batch {
+	unsigned  n;
+	double    v[BATCH_ROWS];
+};
+
+static size_t batch_bytes(unsigned n)
+{
+	return offsetof(struct batch, v) + n * sizeof(double);
+}
+
+/*like insist_write(), pipes may return less than we asked for*/
+static int read_all(int fd, void *buf, size_t count)
+{
+	ssize_t ret;
+	char *p = buf;
+
+	while (count > 0) {
+		ret = read(fd, p, count);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		count -= ret;
+	}
+	return 0;
+}
+
+static void write_all(int fd, const void *buf, size_t count)
+{
+	ssize_t ret;
+	const char *p = buf;
+
+	while (count > 0) {
+		ret = write(fd, p, count);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			perror("write pipe");
+			exit(-1);
+		}
+		p += ret;
+		count -= ret;
+	}
+}
+
+static void send_batch(int fd, struct batch *b)
+{
+	write_all(fd, b, batch_bytes(b->n));
+}
+
+/*returns the number of rows, 0 at the end of the stream*/
+static unsigned recv_batch(int fd, struct batch *b)
+{
+	if (read_all(fd, b, offsetof(struct batch, v)) < 0)
+		return 0;
+	if (b->n > BATCH_ROWS) {
+		fprintf(stderr, "bad batch of %u rows\n", b->n);
+		exit(-1);
+	}
+	if (b->n && read_all(fd, b->v, b->n * sizeof(double)) < 0) {
+		fprintf(stderr, "short batch\n");
+		exit(-1);
+	}
+	return b->n;
+}
+
+/*
+ * The inner loops. One operator per loop and no branches inside,
+ * so that the compiler turns each of them into vector code.
+ */
+static void combine(enum expr_op op, double *restrict acc, const double *restrict in, unsigned n)
+{
+	unsigned j;
+
+	switch (op) {
+	case OP_ADD:
+		for (j = 0; j < n; j++)
+			acc[j] += in[j];
+		break;
+	case OP_SUB:
+		for (j = 0; j < n; j++)
+			acc[j] -= in[j];
+		break;
+	case OP_MUL:
+		for (j = 0; j < n; j++)
+			acc[j] *= in[j];
+		break;
+	case OP_DIV:	/*IEEE: x/0 gives inf or nan, the stream goes on*/
+		for (j = 0; j < n; j++)
+			acc[j] /= in[j];
+		break;
+	case OP_MIN:
+		for (j = 0; j < n; j++)
+			acc[j] = in[j] < acc[j] ? in[j] : acc[j];
+		break;
+	case OP_MAX:
+		for (j = 0; j < n; j++)
+			acc[j] = in[j] > acc[j] ? in[j] : acc[j];
+		break;
+	default:
+		break;
+	}
+}
+
+static void broadcast(double *acc, double val, unsigned n)
+{
+	unsigned j;
+
+	for (j = 0; j < n; j++)
+		acc[j] = val;
+}
+
+/*
+ * A number, or an operator over numbers only: folded here with the loops the
+ * streams use, so that it gives the same bits, and broadcast like a number.
+ */
+static int is_constant(struct tree_node *node, double *val)
+{
+	enum expr_op op = expr_op_of(node);
+	union expr_value v;
+	double in;
+	unsigned i;
+
+	if (node->nr_children == 0) {
+		if (expr_leaf_value(node->name, EXPR_DOUBLE, &v))
+			return 0;
+		*val = v.d;
+		return 1;
+	}
+	for (i = 0; i < node->nr_children; i++) {
+		if (!is_constant(node->children + i, i ? &in : val))
+			return 0;
+		if (i)
+			combine(op, val, &in, 1);
+	}
+	if (op == OP_SUB && node->nr_children == 1) {
+		in = *val;
+		*val = 0.0;
+		combine(OP_SUB, val, &in, 1);
+	}
+	return 1;
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+	size_t ls = strlen(s), lx = strlen(suffix);
+
+	return ls >= lx && strcmp(s + ls - lx, suffix) == 0;
+}
+
+/*a leaf process: stream a column file to the father*/
+static void stream_column(struct tree_node *node, int wfd)
+{
+	struct batch b;
+	FILE *file;
+	char line[LINE_SIZE];
+	int binary = has_suffix(node->name, ".bin");
+	size_t got;
+
+	file = fopen(node->name, "r");
+	if (file == NULL) {
+		perror(node->name);
+		exit(-1);
+	}
+	if (binary) {
+		while ((got = fread(b.v, sizeof(double), BATCH_ROWS, file)) > 0) {
+			b.n = got;
+			send_batch(wfd, &b);
+		}
+	} else {
+		b.n = 0;
+		while (fgets(line, sizeof(line), file) != NULL) {
+			b.v[b.n++] = strtod(line, NULL);
+			if (b.n == BATCH_ROWS) {
+				send_batch(wfd, &b);
+				b.n = 0;
+			}
+		}
+		if (b.n)
+			send_batch(wfd, &b);
+	}
+	fclose(file);
+}
+
+pid_t make_proc_tree(struct tree_node *node, int wfd);
+
+/*complain about a stream process that did not finish its stream*/
+static void check_exit(struct child_state *cs)
+{
+	if (cs->state == CHILD_RUNNING) {
+		fprintf(stderr, "PID = %ld still running after %d ms, killing it\n",
+			(long)cs->pid, EXIT_TIMEOUT_MS);
+		kill(cs->pid, SIGKILL);
+		exit(-1);
+	}
+	if (cs->state == CHILD_LOST) {
+		fprintf(stderr, "PID = %ld cannot be waited for\n", (long)cs->pid);
+		exit(-1);
+	}
+	if (WIFSIGNALED(cs->status) && WTERMSIG(cs->status) == SIGPIPE)
+		return;	/*a longer column, cut short on purpose*/
+	if (!WIFEXITED(cs->status) || WEXITSTATUS(cs->status) != 0)
+		explain_wait_status(cs->pid, cs->status);
+}
+
+/*
+ * An operator process: one pipe per child, since every child sends an ordered
+ * stream. Constant children get no process and are broadcast into the batch.
+ * At least one child is not constant, or the father would have folded us.
+ */
+static void stream_operator(struct tree_node *node, int wfd)
+{
+	enum expr_op op = expr_op_of(node);
+	unsigned i, k, n, nstreams = 0;
+	int *fd, p[2];
+	double *konst;
+	struct batch *in, out;
+	pid_t *kids;
+	struct child_state *res;
+
+	fd = malloc(node->nr_children * sizeof(*fd));
+	konst = malloc(node->nr_children * sizeof(*konst));
+	in = malloc(node->nr_children * sizeof(*in));
+	kids = malloc(node->nr_children * sizeof(*kids));
+	res = malloc(node->nr_children * sizeof(*res));
+	if (fd == NULL || konst == NULL || in == NULL || kids == NULL || res == NULL) {
+		fprintf(stderr, "%s: allocation failed\n", node->name);
+		exit(-1);
+	}
+	for (i = 0; i < node->nr_children; i++) {
+		fd[i] = -1;
+		if (is_constant(node->children + i, konst + i))
+			continue;
+		if (pipe(p)) {
+			perror("pipe");
+			exit(-1);
+		}
+		kids[nstreams++] = make_proc_tree(node->children + i, p[1]);
+		close(p[1]);
+		fd[i] = p[0];
+	}
+
+	for (;;) {
+		/*one batch from every stream, as many rows as the shortest one*/
+		n = BATCH_ROWS;
+		for (i = 0; i < node->nr_children; i++) {
+			if (fd[i] < 0)
+				continue;
+			k = recv_batch(fd[i], in + i);
+			if (k < n)
+				n = k;
+		}
+		if (n == 0)
+			break;
+		out.n = n;
+		for (i = 0; i < node->nr_children; i++)
+			if (fd[i] < 0)
+				broadcast(in[i].v, konst[i], n);
+
+		memcpy(out.v, in[0].v, out.n * sizeof(double));
+		if (op == OP_SUB && node->nr_children == 1) {
+			broadcast(out.v, 0.0, out.n);
+			combine(OP_SUB, out.v, in[0].v, out.n);
+		}
+		for (i = 1; i < node->nr_children; i++)
+			combine(op, out.v, in[i].v, out.n);
+		send_batch(wfd, &out);
+	}
+
+	for (i = 0; i < node->nr_children; i++)
+		if (fd[i] >= 0)
+			close(fd[i]);	/*children still sending get EPIPE and stop*/
+	wait_for_children(kids, nstreams, CHILD_EXITED, EXIT_TIMEOUT_MS, res);
+	for (i = 0; i < nstreams; i++)
+		check_exit(res + i);
+}
+
+pid_t make_proc_tree(struct tree_node *node, int wfd)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {	/*Error*/
+		printf("%s :", node->name);
+		perror("fork");
+		exit(-1);
+	}
+	if (pid == 0) {
+		/*
+		 * All we need is the write end to the father. Pipes of our
+		 * ancestors and siblings must go, or a writer blocked on a
+		 * pipe nobody reads would never see EPIPE.
+		 */
+		if (wfd > 3)
+			close_range(3, wfd - 1, 0);
+		close_range(wfd + 1, ~0U, 0);
+		change_pname(node->name);
+		if (node->nr_children == 0)
+			stream_column(node, wfd);
+		else
+			stream_operator(node, wfd);
+		exit(0);
+	}
+	return pid;
+}
+
+/*% and unknown names cannot be streamed, find them before forking anything*/
+static int check_tree(struct tree_node *node)
+{
+	enum expr_op op = expr_op_of(node);
+	unsigned i;
+
+	if (op == OP_INVALID || op == OP_MOD) {
+		fprintf(stderr, "%s: operator not supported for streams\n", node->name);
+		return -1;
+	}
+	for (i = 0; i < node->nr_children; i++)
+		if (check_tree(node->children + i))
+			return -1;
+	return 0;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*evaluate the tree, rows go to out unless it is NULL; returns how many*/
+static unsigned long long run_tree(struct tree_node *root, FILE *out)
+{
+	int fd[2];
+	unsigned j;
+	unsigned long long rows = 0;
+	double konst;
+	pid_t pid;
+	struct batch b;
+	struct child_state cs;
+
+	if (is_constant(root, &konst)) {
+		if (out)
+			fprintf(out, "%.17g\n", konst);
+		return 1;
+	}
+	if (pipe(fd)) {
+		perror("pipe");
+		exit(1);
+	}
+	pid = make_proc_tree(root, fd[1]);
+	close(fd[1]);
+	while (recv_batch(fd[0], &b) > 0) {
+		if (out)
+			for (j = 0; j < b.n; j++)
+				fprintf(out, "%.17g\n", b.v[j]);
+		rows += b.n;
+	}
+	close(fd[0]);
+	wait_for_children(&pid, 1, CHILD_EXITED, EXIT_TIMEOUT_MS, &cs);
+	check_exit(&cs);
+	return rows;
+}
+
+/*
+ * -T: trees that mix constant subtrees with a column of 1 to 5, each with
+ * what it has to print. A constant subtree must not cut the column short.
+ */
+static const struct {
+	const char  *tree;	/*in the file format, DFS order*/
+	const char  *expect;
+} self_tests[] = {
+	{ "+\n2\nc\n*\n\nc\n0\n\n*\n2\n2\n3\n\n2\n0\n\n3\n0\n\n",
+	  "7\n8\n9\n10\n11\n" },
+	{ "-\n2\nc\n-\n\nc\n0\n\n-\n1\n4\n\n4\n0\n\n",
+	  "5\n6\n7\n8\n9\n" },
+	{ "max\n2\nmin\nc\n\nmin\n2\n2\n9\n\n2\n0\n\n9\n0\n\nc\n0\n\n",
+	  "2\n2\n3\n4\n5\n" },
+	{ "/\n2\n*\n+\n\n*\n2\nc\nc\n\nc\n0\n\nc\n0\n\n+\n2\n1\n1\n\n1\n0\n\n1\n0\n\n",
+	  "0.5\n2\n4.5\n8\n12.5\n" },
+	{ "+\n2\n1\n*\n\n1\n0\n\n*\n2\n2\n3\n\n2\n0\n\n3\n0\n\n",
+	  "7\n" },
+};
+
+static int self_test(void)
+{
+	char dir[] = "/tmp/ask2_streamXXXXXX", *got;
+	size_t len;
+	unsigned i, failed = 0;
+	struct tree_node *root;
+	FILE *file, *out;
+
+	/*the column is "c" in a directory of our own*/
+	if (mkdtemp(dir) == NULL || chdir(dir) < 0) {
+		perror(dir);
+		exit(1);
+	}
+	file = fopen("c", "w");
+	if (file == NULL) {
+		perror("c");
+		exit(1);
+	}
+	fprintf(file, "1\n2\n3\n4\n5\n");
+	fclose(file);
+
+	for (i = 0; i < sizeof(self_tests) / sizeof(self_tests[0]); i++) {
+		file = fmemopen((void *)self_tests[i].tree, strlen(self_tests[i].tree), "r");
+		out = open_memstream(&got, &len);
+		if (file == NULL || out == NULL) {
+			perror("self test");
+			exit(1);
+		}
+		root = get_tree_from_stream(file);
+		fclose(file);
+		run_tree(root, out);
+		fclose(out);
+		if (strcmp(got, self_tests[i].expect) != 0) {
+			fprintf(stderr, "self test %u: expected\n%sgot\n%s", i, self_tests[i].expect, got);
+			failed++;
+		}
+		free(got);
+		free_tree(root);
+	}
+	unlink("c");
+	if (chdir("/") == 0)
+		rmdir(dir);
+	fprintf(stderr, "self test: %u of %u failed\n", failed, i);
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, quiet = 0;
+	unsigned long long rows;
+	double t;
+	struct tree_node *root;
+
+	while ((opt = getopt(argc, argv, "qT")) != -1) {
+		switch (opt) {
+		case 'q':	/*only count the rows, for measuring throughput*/
+			quiet = 1;
+			break;
+		case 'T':	/*check constant folding against known results*/
+			return self_test();
+		default:
+			fprintf(stderr, "Usage: %s [-q] <input_tree_file>\n       %s -T\n\n", argv[0], argv[0]);
+			exit(1);
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "Usage: %s [-q] <input_tree_file>\n       %s -T\n\n", argv[0], argv[0]);
+		exit(1);
+	}
+	root = get_tree_from_file(argv[optind]);
+	if (root == NULL || check_tree(root))
+		exit(1);
+
+	t = now_sec();
+	rows = run_tree(root, quiet ? NULL : stdout);
+	fflush(stdout);
+	t = now_sec() - t;
+	fprintf(stderr, "%llu rows in %.3f s, %.0f rows/s\n", rows, t, t > 0 ? rows / t : 0.0);
+	return 0;
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "proc-common.h"
+
+/*
+ * Render a binary event log, as written by explain_wait_status()
+ * with PROC_EVLOG set, as text. Every process writes its own records
+ * in batches, so they are sorted by time first.
+ */
+
+static int by_time(const void *a, const void *b)
+{
+	const struct evlog_rec *ra = a, *rb = b;
+
+	if (ra->ts != rb->ts)
+		return ra->ts < rb->ts ? -1 : 1;
+	return 0;
+}
+
+static void print_rec(struct evlog_rec *r, unsigned long long t0)
+{
+	printf("[%12.6f] ", (r->ts - t0) / 1e9);
+	switch (r->event) {
+	case EV_EXITED:
+		printf("My PID = %ld: Child PID = %ld terminated normally, exit status = %d\n",
+			(long)r->pid, (long)r->child, WEXITSTATUS(r->status));
+		break;
+	case EV_SIGNALED:
+		printf("My PID = %ld: Child PID = %ld was terminated by a signal, signo = %d\n",
+			(long)r->pid, (long)r->child, WTERMSIG(r->status));
+		break;
+	case EV_STOPPED:
+		printf("My PID = %ld: Child PID = %ld has been stopped by a signal, signo = %d\n",
+			(long)r->pid, (long)r->child, WSTOPSIG(r->status));
+		break;
+	case EV_CONTINUED:
+		printf("My PID = %ld: Child PID = %ld has been continued\n",
+			(long)r->pid, (long)r->child);
+		break;
+	default:
+		printf("My PID = %ld: Child PID = %ld unknown event %d, status = %d\n",
+			(long)r->pid, (long)r->child, r->event, r->status);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *file;
+	struct evlog_rec *recs = NULL;
+	size_t n = 0, cap = 0, i, bad = 0;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <event_log_file>\n", argv[0]);
+		exit(1);
+	}
+	file = fopen(argv[1], "r");
+	if (file == NULL) {
+		perror(argv[1]);
+		exit(1);
+	}
+	for (;;) {
+		if (n == cap) {
+			cap = cap ? 2 * cap : 1024;
+			recs = realloc(recs, cap * sizeof(*recs));
+			if (recs == NULL) {
+				fprintf(stderr, "allocation failed\n");
+				exit(1);
+			}
+		}
+		if (fread(&recs[n], sizeof(*recs), 1, file) != 1)
+			break;
+		if (recs[n].magic != EVLOG_MAGIC)
+			bad++;
+		else
+			n++;
+	}
+	fclose(file);
+	if (bad)
+		fprintf(stderr, "%s: skipped %zu bad records\n", argv[1], bad);
+
+	qsort(recs, n, sizeof(*recs), by_time);
+	for (i = 0; i < n; i++)
+		print_rec(&recs[i], recs[0].ts);
+	free(recs);
+	return 0;
+}
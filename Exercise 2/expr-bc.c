@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "tree.h"
+#include "expr.h"
+#include "expr-bc.h"
+
+#define NO_INSN ((unsigned)-1)
+
+/* compiler state */
+struct bc_build {
+	struct bc_prog  *prog;
+	unsigned        insn_cap, argv_cap;
+	unsigned        *table;		/* hash table of instruction numbers */
+	unsigned        table_mask;
+	int             dedupe;
+	int             err;
+};
+
+static void *
+xrealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (p == NULL) {
+		fprintf(stderr, "bc_compile: allocation failed\n");
+		exit(1);
+	}
+	return p;
+}
+
+static uint64_t
+hash_mix(uint64_t h, uint64_t v)
+{
+	h ^= v;
+	return h * 0x100000001b3ULL;	/* FNV-1a step */
+}
+
+static uint64_t
+hash_insn(enum expr_op op, union expr_value val, const unsigned *args, unsigned nargs)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned i;
+
+	h = hash_mix(h, op);
+	if (op == OP_LEAF)
+		return hash_mix(h, (uint64_t)val.i);	/* same bits for a double */
+	for (i = 0; i < nargs; i++)
+		h = hash_mix(h, args[i]);
+	return h;
+}
+
+static int
+same_insn(struct bc_prog *prog, struct bc_insn *in, enum expr_op op,
+	union expr_value val, const unsigned *args, unsigned nargs)
+{
+	if (in->op != op)
+		return 0;
+	if (op == OP_LEAF)
+		return in->val.i == val.i;
+	return in->nargs == nargs &&
+		memcmp(prog->argv + in->args, args, nargs * sizeof(*args)) == 0;
+}
+
+/*
+ * Return the instruction for (op, val or args), appending it only
+ * if an identical one does not exist yet. args already lives at the
+ * end of prog->argv, it is dropped again for a duplicate.
+ */
+static unsigned
+intern(struct bc_build *b, enum expr_op op, union expr_value val, unsigned args, unsigned nargs)
+{
+	struct bc_prog *prog = b->prog;
+	uint64_t h = hash_insn(op, val, prog->argv + args, nargs);
+	unsigned slot = 0, i, level = 0;
+	struct bc_insn *in;
+
+	for (slot = h & b->table_mask; b->dedupe && b->table[slot] != NO_INSN; slot = (slot + 1) & b->table_mask) {
+		in = prog->insn + b->table[slot];
+		if (same_insn(prog, in, op, val, prog->argv + args, nargs)) {
+			prog->nr_argv = args;
+			return b->table[slot];
+		}
+	}
+
+	if (prog->nr_insns == b->insn_cap) {
+		b->insn_cap = b->insn_cap ? 2 * b->insn_cap : 64;
+		prog->insn = xrealloc(prog->insn, b->insn_cap * sizeof(*prog->insn));
+	}
+	for (i = 0; i < nargs; i++)
+		if (prog->insn[prog->argv[args + i]].level + 1 > level)
+			level = prog->insn[prog->argv[args + i]].level + 1;
+	in = prog->insn + prog->nr_insns;
+	in->op = op;
+	in->nargs = nargs;
+	in->args = args;
+	in->level = level;
+	in->val = val;
+	if (level + 1 > prog->nr_levels)
+		prog->nr_levels = level + 1;
+	if (b->dedupe)
+		b->table[slot] = prog->nr_insns;
+	return prog->nr_insns++;
+}
+
+static unsigned
+compile_node(struct bc_build *b, struct tree_node *node)
+{
+	struct bc_prog *prog = b->prog;
+	enum expr_op op = expr_op_of(node);
+	union expr_value val = { 0 };
+	unsigned i, args, *tmp;
+	int err;
+
+	if (b->err)
+		return NO_INSN;
+	if (op == OP_INVALID || (op == OP_MOD && prog->type == EXPR_DOUBLE)) {
+		b->err = EXPR_ESYNTAX;
+		return NO_INSN;
+	}
+	if (op == OP_LEAF) {
+		err = expr_leaf_value(node->name, prog->type, &val);
+		if (err) {
+			b->err = err;
+			return NO_INSN;
+		}
+		return intern(b, OP_LEAF, val, prog->nr_argv, 0);
+	}
+
+	/*
+	 * Children are compiled first and may append operands of their own,
+	 * so collect ours on the side and copy them to the end afterwards.
+	 */
+	tmp = malloc(node->nr_children * sizeof(*tmp));
+	if (tmp == NULL) {
+		fprintf(stderr, "bc_compile: allocation failed\n");
+		exit(1);
+	}
+	for (i = 0; i < node->nr_children; i++)
+		tmp[i] = compile_node(b, node->children + i);
+	if (b->err) {
+		free(tmp);
+		return NO_INSN;
+	}
+	if (prog->nr_argv + node->nr_children > b->argv_cap) {
+		while (prog->nr_argv + node->nr_children > b->argv_cap)
+			b->argv_cap = b->argv_cap ? 2 * b->argv_cap : 64;
+		prog->argv = xrealloc(prog->argv, b->argv_cap * sizeof(*prog->argv));
+	}
+	args = prog->nr_argv;
+	memcpy(prog->argv + args, tmp, node->nr_children * sizeof(*tmp));
+	prog->nr_argv += node->nr_children;
+	free(tmp);
+	return intern(b, op, val, args, node->nr_children);
+}
+
+/* counting sort of the instructions by level, for bc_eval_parallel() */
+static void
+sort_levels(struct bc_prog *prog)
+{
+	unsigned i, l, *pos;
+
+	prog->by_level = xrealloc(NULL, prog->nr_insns * sizeof(unsigned));
+	prog->level_start = xrealloc(NULL, (prog->nr_levels + 1) * sizeof(unsigned));
+	pos = xrealloc(NULL, (prog->nr_levels + 1) * sizeof(unsigned));
+	memset(prog->level_start, 0, (prog->nr_levels + 1) * sizeof(unsigned));
+	for (i = 0; i < prog->nr_insns; i++)
+		prog->level_start[prog->insn[i].level + 1]++;
+	for (l = 0; l < prog->nr_levels; l++)
+		prog->level_start[l + 1] += prog->level_start[l];
+	memcpy(pos, prog->level_start, (prog->nr_levels + 1) * sizeof(unsigned));
+	for (i = 0; i < prog->nr_insns; i++)
+		prog->by_level[pos[prog->insn[i].level]++] = i;
+	free(pos);
+}
+
+struct bc_prog *
+bc_compile(struct tree_node *root, enum expr_type type, int dedupe, int *err)
+{
+	struct bc_build b;
+	unsigned i, size;
+
+	memset(&b, 0, sizeof(b));
+	b.prog = calloc(1, sizeof(*b.prog));
+	if (b.prog == NULL) {
+		fprintf(stderr, "bc_compile: allocation failed\n");
+		exit(1);
+	}
+	b.prog->type = type;
+	b.dedupe = dedupe;
+	b.prog->nr_nodes = expr_tree_size(root);
+	for (size = 64; size < 2 * b.prog->nr_nodes; size *= 2)
+		;
+	b.table = xrealloc(NULL, size * sizeof(*b.table));
+	for (i = 0; i < size; i++)
+		b.table[i] = NO_INSN;
+	b.table_mask = size - 1;
+
+	compile_node(&b, root);
+	free(b.table);
+	if (b.err) {
+		*err = b.err;
+		bc_free(b.prog);
+		return NULL;
+	}
+	sort_levels(b.prog);
+	b.prog->vals = xrealloc(NULL, b.prog->nr_insns * sizeof(union expr_value));
+	*err = EXPR_OK;
+	return b.prog;
+}
+
+void
+bc_free(struct bc_prog *prog)
+{
+	free(prog->insn);
+	free(prog->argv);
+	free(prog->by_level);
+	free(prog->level_start);
+	free(prog->vals);
+	free(prog);
+}
+
+/* the same left fold as expr_fold(), over the values of the operands */
+static int
+eval_insn(struct bc_prog *prog, unsigned i)
+{
+	struct bc_insn *in = prog->insn + i;
+	union expr_value *vals = prog->vals, *res = vals + i;
+	const unsigned *arg = prog->argv + in->args;
+	unsigned k;
+	int err;
+
+	if (in->op == OP_LEAF) {
+		*res = in->val;
+		return EXPR_OK;
+	}
+	if (in->op == OP_SUB && in->nargs == 1) {
+		if (prog->type == EXPR_INT64)
+			res->i = 0;
+		else
+			res->d = 0.0;
+		return expr_apply(OP_SUB, prog->type, res, vals[arg[0]]);
+	}
+	*res = vals[arg[0]];
+	for (k = 1; k < in->nargs; k++) {
+		err = expr_apply(in->op, prog->type, res, vals[arg[k]]);
+		if (err)
+			return err;
+	}
+	return EXPR_OK;
+}
+
+int
+bc_eval_range(struct bc_prog *prog, unsigned lo, unsigned hi)
+{
+	unsigned i;
+	int err;
+
+	for (i = lo; i < hi; i++) {
+		err = eval_insn(prog, i);
+		if (err)
+			return err;
+	}
+	return EXPR_OK;
+}
+
+int
+bc_eval(struct bc_prog *prog, union expr_value *res)
+{
+	int err;
+
+	err = bc_eval_range(prog, 0, prog->nr_insns);
+	if (err)
+		return err;
+	*res = prog->vals[prog->nr_insns - 1];	/* the root is compiled last */
+	return EXPR_OK;
+}
+
+/*
+ * The pool: the caller is thread 0 and nr_threads - 1 workers wait on
+ * the barrier for a program. Every level is split evenly between all
+ * threads and a barrier separates it from the next one.
+ */
+struct bc_pool {
+	unsigned           nr_threads;
+	pthread_t          *tid;
+	pthread_barrier_t  barrier;
+	struct bc_prog     *prog;	/* NULL tells the workers to exit */
+	int                err;
+};
+
+struct bc_worker {
+	struct bc_pool  *pool;
+	unsigned        id;
+};
+
+static void
+eval_levels(struct bc_pool *pool, unsigned id)
+{
+	struct bc_prog *prog = pool->prog;
+	unsigned l, k, lo, hi, n;
+	int err;
+
+	for (l = 0; l < prog->nr_levels; l++) {
+		n = prog->level_start[l + 1] - prog->level_start[l];
+		lo = prog->level_start[l] + (unsigned long)n * id / pool->nr_threads;
+		hi = prog->level_start[l] + (unsigned long)n * (id + 1) / pool->nr_threads;
+		for (k = lo; k < hi; k++) {
+			err = eval_insn(prog, prog->by_level[k]);
+			if (err)
+				__atomic_store_n(&pool->err, err, __ATOMIC_RELAXED);
+		}
+		pthread_barrier_wait(&pool->barrier);
+	}
+}
+
+static void *
+bc_worker_main(void *arg)
+{
+	struct bc_worker *w = arg;
+	struct bc_pool *pool = w->pool;
+
+	for (;;) {
+		pthread_barrier_wait(&pool->barrier);	/* wait for a program */
+		if (pool->prog == NULL)
+			break;
+		eval_levels(pool, w->id);
+	}
+	free(w);
+	return NULL;
+}
+
+struct bc_pool *
+bc_pool_create(unsigned nr_threads)
+{
+	struct bc_pool *pool;
+	struct bc_worker *w;
+	unsigned i;
+	int ret;
+
+	if (nr_threads < 1)
+		nr_threads = 1;
+	pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		fprintf(stderr, "bc_pool_create: allocation failed\n");
+		exit(1);
+	}
+	pool->nr_threads = nr_threads;
+	pool->tid = xrealloc(NULL, nr_threads * sizeof(pthread_t));
+	pthread_barrier_init(&pool->barrier, NULL, nr_threads);
+	for (i = 1; i < nr_threads; i++) {
+		w = xrealloc(NULL, sizeof(*w));
+		w->pool = pool;
+		w->id = i;
+		ret = pthread_create(&pool->tid[i], NULL, bc_worker_main, w);
+		if (ret) {
+			fprintf(stderr, "bc_pool_create: pthread_create: %s\n", strerror(ret));
+			exit(1);
+		}
+	}
+	return pool;
+}
+
+void
+bc_pool_destroy(struct bc_pool *pool)
+{
+	unsigned i;
+
+	pool->prog = NULL;
+	pthread_barrier_wait(&pool->barrier);
+	for (i = 1; i < pool->nr_threads; i++)
+		pthread_join(pool->tid[i], NULL);
+	pthread_barrier_destroy(&pool->barrier);
+	free(pool->tid);
+	free(pool);
+}
+
+int
+bc_eval_parallel(struct bc_pool *pool, struct bc_prog *prog, union expr_value *res)
+{
+	pool->prog = prog;
+	pool->err = EXPR_OK;
+	pthread_barrier_wait(&pool->barrier);	/* start the workers */
+	eval_levels(pool, 0);
+	if (pool->err)
+		return pool->err;
+	*res = prog->vals[prog->nr_insns - 1];
+	return EXPR_OK;
+}
@@ -0,0 +1,66 @@
+#ifndef EXPR_BC_H
+#define EXPR_BC_H
+
+#include "tree.h"
+#include "expr.h"
+
+/******************************************************************************
+ * Data structure definitions
+ */
+
+/*
+ * An expression tree compiled to a flat array of instructions in postfix
+ * order: the operands of an instruction always come before it, so a single
+ * pass over the array evaluates the whole expression. Identical subtrees are
+ * compiled once (hash consing), which turns the tree into a DAG.
+ * Without deduplication every subtree is a contiguous range of the array,
+ * ending with its root.
+ */
+struct bc_insn {
+	enum expr_op      op;		/* OP_LEAF: constant val */
+	unsigned          nargs;
+	unsigned          args;		/* operands are argv[args .. args+nargs-1] */
+	unsigned          level;	/* 0 for constants, 1 + deepest operand otherwise */
+	union expr_value  val;
+};
+
+struct bc_prog {
+	enum expr_type    type;
+	struct bc_insn    *insn;
+	unsigned          nr_insns;
+	unsigned          *argv;	/* instruction numbers of all operands */
+	unsigned          nr_argv;
+	unsigned          nr_nodes;	/* size of the tree before deduplication */
+	unsigned          nr_levels;
+	unsigned          *by_level;	/* instruction numbers sorted by level */
+	unsigned          *level_start;	/* level l is by_level[level_start[l] .. level_start[l+1]-1] */
+	union expr_value  *vals;	/* scratch space for evaluation */
+};
+
+struct bc_pool;
+
+
+/******************************************************************************
+ * Helper Functions
+ */
+
+/* compile the tree; returns NULL and sets *err for a bad operator or operand */
+struct bc_prog *bc_compile(struct tree_node *root, enum expr_type type, int dedupe, int *err);
+
+void bc_free(struct bc_prog *prog);
+
+/* evaluate in the calling thread, one pass over the array */
+int bc_eval(struct bc_prog *prog, union expr_value *res);
+
+/* evaluate instructions lo .. hi-1, their operands must have been evaluated */
+int bc_eval_range(struct bc_prog *prog, unsigned lo, unsigned hi);
+
+/* a pool of nr_threads threads (including the caller) for bc_eval_parallel() */
+struct bc_pool *bc_pool_create(unsigned nr_threads);
+
+void bc_pool_destroy(struct bc_pool *pool);
+
+/* evaluate one level of the DAG at a time, the instructions of a level in parallel */
+int bc_eval_parallel(struct bc_pool *pool, struct bc_prog *prog, union expr_value *res);
+
+#endif /* EXPR_BC_H */
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "tree.h"
+#include "expr.h"
+
+enum expr_op
+expr_op_of(struct tree_node *node)
+{
+	if (node->nr_children == 0)
+		return OP_LEAF;
+	if (strcmp(node->name, "+") == 0)
+		return OP_ADD;
+	if (strcmp(node->name, "-") == 0)
+		return OP_SUB;
+	if (strcmp(node->name, "*") == 0)
+		return OP_MUL;
+	if (strcmp(node->name, "/") == 0)
+		return OP_DIV;
+	if (strcmp(node->name, "%") == 0)
+		return OP_MOD;
+	if (strcmp(node->name, "min") == 0)
+		return OP_MIN;
+	if (strcmp(node->name, "max") == 0)
+		return OP_MAX;
+	return OP_INVALID;
+}
+
+int
+expr_leaf_value(const char *name, enum expr_type type, union expr_value *val)
+{
+	char *end;
+
+	errno = 0;
+	if (type == EXPR_INT64)
+		val->i = strtoll(name, &end, 10);
+	else
+		val->d = strtod(name, &end);
+	if (end == name || *end != '\0')
+		return EXPR_ESYNTAX;
+	if (errno == ERANGE)
+		return EXPR_EOVERFLOW;
+	return EXPR_OK;
+}
+
+static int
+apply_int64(enum expr_op op, int64_t *acc, int64_t val)
+{
+	switch (op) {
+	case OP_ADD:
+		return __builtin_add_overflow(*acc, val, acc) ? EXPR_EOVERFLOW : EXPR_OK;
+	case OP_SUB:
+		return __builtin_sub_overflow(*acc, val, acc) ? EXPR_EOVERFLOW : EXPR_OK;
+	case OP_MUL:
+		return __builtin_mul_overflow(*acc, val, acc) ? EXPR_EOVERFLOW : EXPR_OK;
+	case OP_DIV:
+	case OP_MOD:
+		if (val == 0)
+			return EXPR_EDIVZERO;
+		if (*acc == INT64_MIN && val == -1)	/* the only overflowing division */
+			return EXPR_EOVERFLOW;
+		*acc = (op == OP_DIV) ? *acc / val : *acc % val;
+		return EXPR_OK;
+	case OP_MIN:
+		if (val < *acc)
+			*acc = val;
+		return EXPR_OK;
+	case OP_MAX:
+		if (val > *acc)
+			*acc = val;
+		return EXPR_OK;
+	default:
+		return EXPR_ESYNTAX;
+	}
+}
+
+static int
+apply_double(enum expr_op op, double *acc, double val)
+{
+	switch (op) {
+	case OP_ADD:
+		*acc += val;
+		return EXPR_OK;
+	case OP_SUB:
+		*acc -= val;
+		return EXPR_OK;
+	case OP_MUL:
+		*acc *= val;
+		return EXPR_OK;
+	case OP_DIV:
+		if (val == 0.0)
+			return EXPR_EDIVZERO;
+		*acc /= val;
+		return EXPR_OK;
+	case OP_MIN:
+		if (val < *acc)
+			*acc = val;
+		return EXPR_OK;
+	case OP_MAX:
+		if (val > *acc)
+			*acc = val;
+		return EXPR_OK;
+	default:	/* no % for doubles */
+		return EXPR_ESYNTAX;
+	}
+}
+
+int
+expr_apply(enum expr_op op, enum expr_type type,
+	union expr_value *acc, union expr_value val)
+{
+	if (type == EXPR_INT64)
+		return apply_int64(op, &acc->i, val.i);
+	return apply_double(op, &acc->d, val.d);
+}
+
+/*
+ * Left fold of the children values with the operator of node,
+ * i.e. ((v0 op v1) op v2) ... A single operand of '-' is negated.
+ */
+int
+expr_fold(struct tree_node *node, enum expr_type type,
+	union expr_value *vals, union expr_value *res)
+{
+	enum expr_op op = expr_op_of(node);
+	unsigned i;
+	int err;
+
+	if (op == OP_LEAF || op == OP_INVALID)
+		return EXPR_ESYNTAX;
+
+	if (op == OP_SUB && node->nr_children == 1) {
+		if (type == EXPR_INT64)
+			res->i = 0;
+		else
+			res->d = 0.0;
+		return expr_apply(OP_SUB, type, res, vals[0]);
+	}
+
+	*res = vals[0];
+	for (i = 1; i < node->nr_children; i++) {
+		err = expr_apply(op, type, res, vals[i]);
+		if (err)
+			return err;
+	}
+	return EXPR_OK;
+}
+
+int
+expr_eval_local(struct tree_node *node, enum expr_type type, union expr_value *res)
+{
+	union expr_value *vals;
+	unsigned i;
+	int err = EXPR_OK;
+
+	if (node->nr_children == 0)
+		return expr_leaf_value(node->name, type, res);
+
+	vals = malloc(node->nr_children * sizeof(*vals));
+	if (vals == NULL) {
+		fprintf(stderr, "expr_eval_local: allocation failed\n");
+		exit(1);
+	}
+	for (i = 0; i < node->nr_children && !err; i++)
+		err = expr_eval_local(node->children + i, type, vals + i);
+	if (!err)
+		err = expr_fold(node, type, vals, res);
+	free(vals);
+	return err;
+}
+
+unsigned
+expr_tree_size(struct tree_node *node)
+{
+	unsigned i, size = 1;
+
+	for (i = 0; i < node->nr_children; i++)
+		size += expr_tree_size(node->children + i);
+	return size;
+}
+
+static unsigned
+size_upto(struct tree_node *node, unsigned limit, unsigned size)
+{
+	unsigned i;
+
+	size++;
+	for (i = 0; i < node->nr_children && size <= limit; i++)
+		size = size_upto(node->children + i, limit, size);
+	return size;
+}
+
+/*
+ * Bounded version of expr_tree_size(), so that checking every node
+ * of a big tree against a small limit stays linear.
+ */
+unsigned
+expr_tree_size_upto(struct tree_node *node, unsigned limit)
+{
+	unsigned size = size_upto(node, limit, 0);
+
+	return size > limit ? limit + 1 : size;
+}
+
+static void
+random_node(struct tree_node *node, unsigned budget, unsigned max_children, unsigned *seed)
+{
+	static const char *ops[] = { "+", "-", "min", "max" };
+	unsigned i, k, share, rest;
+
+	if (budget == 1) {
+		node->nr_children = 0;
+		node->children = NULL;
+		snprintf(node->name, NODE_NAME_SIZE, "%d", rand_r(seed) % 10);
+		return;
+	}
+
+	k = 1 + rand_r(seed) % (budget - 1 < max_children ? budget - 1 : max_children);
+	node->nr_children = k;
+	node->children = calloc(k, sizeof(struct tree_node));
+	if (node->children == NULL) {
+		fprintf(stderr, "expr_random_tree: allocation failed\n");
+		exit(1);
+	}
+	/* a product only of a few digits, so that it cannot grow */
+	if (budget - 1 == k && k <= 3 && rand_r(seed) % 2)
+		snprintf(node->name, NODE_NAME_SIZE, "*");
+	else
+		snprintf(node->name, NODE_NAME_SIZE, "%s", ops[rand_r(seed) % 4]);
+
+	/* every child gets at least one node, the rest is spread at random */
+	rest = budget - 1 - k;
+	for (i = 0; i < k; i++) {
+		share = (i == k - 1) ? rest : (rest ? rand_r(seed) % (rest + 1) : 0);
+		if (i < k - 1 && share > rest / 2 + 1)
+			share = rest / 2 + 1;	/* keep the depth down */
+		rest -= share;
+		random_node(node->children + i, 1 + share, max_children, seed);
+	}
+}
+
+struct tree_node *
+expr_random_tree(unsigned nr_nodes, unsigned max_children, unsigned seed)
+{
+	struct tree_node *root;
+
+	if (nr_nodes == 0 || max_children == 0)
+		return NULL;
+	root = calloc(1, sizeof(*root));
+	if (root == NULL) {
+		fprintf(stderr, "expr_random_tree: allocation failed\n");
+		exit(1);
+	}
+	random_node(root, nr_nodes, max_children, &seed);
+	return root;
+}
+
+char *
+expr_format(char *buf, size_t size, enum expr_type type, union expr_value val)
+{
+	if (type == EXPR_INT64)
+		snprintf(buf, size, "%" PRId64, val.i);
+	else
+		snprintf(buf, size, "%.17g", val.d);
+	return buf;
+}
+
+const char *
+expr_strerror(int err)
+{
+	switch (err) {
+	case EXPR_OK:
+		return "success";
+	case EXPR_EOVERFLOW:
+		return "integer overflow";
+	case EXPR_EDIVZERO:
+		return "division by zero";
+	case EXPR_ESYNTAX:
+		return "bad operator or operand";
+	default:
+		return "unknown error";
+	}
+}
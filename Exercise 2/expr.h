@@ -0,0 +1,94 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "tree.h"
+
+/******************************************************************************
+ * Data structure definitions
+ */
+
+/* type of every operand in an expression tree */
+enum expr_type {
+	EXPR_INT64,
+	EXPR_DOUBLE,
+};
+
+/* operators, taken from the node name; leaves are numbers */
+enum expr_op {
+	OP_LEAF,
+	OP_ADD,		/* +   : sum of all children */
+	OP_SUB,		/* -   : first minus the rest, negation with one child */
+	OP_MUL,		/* *   : product of all children */
+	OP_DIV,		/* /   : first divided by the rest */
+	OP_MOD,		/* %   : first modulo the rest (int64 only) */
+	OP_MIN,		/* min : smallest child */
+	OP_MAX,		/* max : largest child */
+	OP_INVALID,
+};
+
+/* error codes, 0 means success */
+enum expr_err {
+	EXPR_OK,
+	EXPR_EOVERFLOW,
+	EXPR_EDIVZERO,
+	EXPR_ESYNTAX,
+};
+
+union expr_value {
+	int64_t i;
+	double  d;
+};
+
+/*
+ * What a child sends to its father: the index of the child,
+ * so that all children can share one pipe, and its result.
+ */
+struct expr_msg {
+	unsigned          idx;
+	int               err;
+	union expr_value  val;
+};
+
+
+/******************************************************************************
+ * Helper Functions
+ */
+
+/* operator of an internal node, OP_LEAF for nodes without children */
+enum expr_op expr_op_of(struct tree_node *node);
+
+/* parse the name of a leaf as a number of the given type */
+int expr_leaf_value(const char *name, enum expr_type type, union expr_value *val);
+
+/* acc = acc op val, checking for overflow and division by zero */
+int expr_apply(enum expr_op op, enum expr_type type,
+	union expr_value *acc, union expr_value val);
+
+/* evaluate node over the already computed values of its children */
+int expr_fold(struct tree_node *node, enum expr_type type,
+	union expr_value *vals, union expr_value *res);
+
+/* evaluate a whole subtree in the calling process */
+int expr_eval_local(struct tree_node *node, enum expr_type type, union expr_value *res);
+
+/* number of nodes in a subtree */
+unsigned expr_tree_size(struct tree_node *node);
+
+/* same, but stops counting once it is above limit and returns limit + 1 */
+unsigned expr_tree_size_upto(struct tree_node *node, unsigned limit);
+
+/*
+ * A random expression of exactly nr_nodes nodes, at most max_children per operator,
+ * with single digit leaves and operators chosen so that int64 never overflows.
+ */
+struct tree_node *expr_random_tree(unsigned nr_nodes, unsigned max_children, unsigned seed);
+
+/* format a value into buf */
+char *expr_format(char *buf, size_t size, enum expr_type type, union expr_value val);
+
+const char *expr_strerror(int err);
+
+#endif /* EXPR_H */
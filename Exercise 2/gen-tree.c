@@ -0,0 +1,107 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tree.h"
+#include "expr.h"
+
+/*
+ * Writes random input files for the tree programs to stdout.
+ *
+ * Plain trees get unique names and a chosen shape. Expressions (-e) are the
+ * ones of ask2_4 -g, preceded by a comment with their value, so that a run of
+ * ask2_4 on the file can be checked.
+ */
+
+#define VAL_BUF_SIZE 32
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n nodes] [-f fanout] [-F fixed|uniform|geometric]\n"
+		"       %*s [-D depth] [-l name_len] [-r seed]\n"
+		"       %s -e [-d] [-n nodes] [-f max_children] [-r seed]\n"
+		"  -n nodes     number of nodes (default 100)\n"
+		"  -f fanout    children of an internal node, the mean for\n"
+		"               uniform and geometric (default 2)\n"
+		"  -F dist      distribution of the fanout (default fixed)\n"
+		"  -D depth     deepest level below the root, 0 for no limit\n"
+		"  -l name_len  pad node names to this many letters\n"
+		"  -r seed      random seed (default 1)\n"
+		"  -e           an expression, with its value as a comment\n"
+		"  -d           with -e, the value with double operands\n\n",
+		prog, (int)strlen(prog), "", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, expr = 0, err;
+	unsigned seed = 1;
+	enum expr_type type = EXPR_INT64;
+	struct tree_shape shape = { 100, 2, FANOUT_FIXED, 0, 0 };
+	struct tree_node *root;
+	union expr_value val;
+	char buf[VAL_BUF_SIZE];
+
+	while ((opt = getopt(argc, argv, "n:f:F:D:l:r:ed")) != -1) {
+		switch (opt) {
+		case 'n':
+			shape.nr_nodes = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			shape.fanout = strtoul(optarg, NULL, 10);
+			break;
+		case 'F':
+			if (!strcmp(optarg, "fixed"))
+				shape.dist = FANOUT_FIXED;
+			else if (!strcmp(optarg, "uniform"))
+				shape.dist = FANOUT_UNIFORM;
+			else if (!strcmp(optarg, "geometric"))
+				shape.dist = FANOUT_GEOMETRIC;
+			else
+				usage(argv[0]);
+			break;
+		case 'D':
+			shape.max_depth = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			shape.name_len = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'e':
+			expr = 1;
+			break;
+		case 'd':
+			type = EXPR_DOUBLE;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || shape.nr_nodes == 0 || shape.fanout == 0)
+		usage(argv[0]);
+
+	if (expr) {
+		root = expr_random_tree(shape.nr_nodes, shape.fanout, seed);
+		err = expr_eval_local(root, type, &val);
+		if (err) {
+			fprintf(stderr, "%s: generated expression fails: %s\n",
+				argv[0], expr_strerror(err));
+			exit(1);
+		}
+		printf("# %u nodes, result %s\n", shape.nr_nodes,
+			expr_format(buf, sizeof(buf), type, val));
+	} else {
+		root = random_tree(&shape, seed);
+		printf("# %u nodes, fanout %u\n", shape.nr_nodes, shape.fanout);
+	}
+	write_tree(stdout, root);
+	free_tree(root);
+	if (fflush(stdout)) {
+		perror("write");
+		exit(1);
+	}
+	return 0;
+}
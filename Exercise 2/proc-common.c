@@ -4,11 +4,18 @@
 #include <unistd.h>
 #include <assert.h>
 #include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
 
 #include <sys/types.h>
 #include <sys/prctl.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 
 #include "proc-common.h"
 
@@ -50,6 +57,148 @@ change_pname(const char *new_name)
 	}
 }
 
+/*
+ * Binary event log.
+ *
+ * Writers reserve a slot by incrementing head, fill it in and then publish it
+ * by storing seq with release semantics. A signal handler may interrupt a
+ * writer half way, so flushing stops at the first unpublished slot and leaves
+ * it for later. Flushes are serialized with a try-lock: a signal handler never
+ * waits for the code it interrupted, at worst the ring fills up and further
+ * events are counted as dropped.
+ */
+#define EVLOG_SIZE   4096			/* records, a power of 2 */
+#define EVLOG_SLACK  16				/* slots for writers racing with the full check */
+
+static struct {
+	int                 fd;		/* -1 until enabled */
+	pid_t               pid;	/* getpid(), kept here to save a system call per event */
+	int                 hooked;	/* atfork and atexit handlers installed */
+	unsigned int        head;	/* next slot to reserve */
+	unsigned int        tail;	/* next slot to write out */
+	int                 flushing;
+	unsigned int        dropped;
+	struct evlog_rec    ring[EVLOG_SIZE];
+} evlog = { .fd = -1 };
+
+static void evlog_atexit(void);
+
+static void evlog_atfork_child(void)
+{
+	/* the parent's records are the parent's to write */
+	evlog.pid = getpid();
+	evlog.head = evlog.tail = 0;
+	evlog.flushing = 0;
+	evlog.dropped = 0;
+}
+
+int evlog_open(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return -1;
+	if (evlog.fd >= 0)
+		close(evlog.fd);
+	evlog.fd = fd;
+	evlog.pid = getpid();
+	if (!evlog.hooked) {
+		evlog.hooked = 1;
+		pthread_atfork(NULL, NULL, evlog_atfork_child);
+		atexit(evlog_atexit);
+	}
+	return 0;
+}
+
+/*
+ * Run before main(), so that no signal handler can be the first to ask:
+ * getenv(), open() and the hooks are not async-signal-safe.
+ */
+__attribute__((constructor)) void evlog_init(void)
+{
+	static int done;
+	const char *path;
+
+	if (done)
+		return;
+	done = 1;
+	path = getenv("PROC_EVLOG");
+	if (path != NULL && evlog.fd < 0)
+		evlog_open(path);
+}
+
+/* all a signal handler looks at */
+static int evlog_enabled(void)
+{
+	return __atomic_load_n(&evlog.fd, __ATOMIC_ACQUIRE) >= 0;
+}
+
+void evlog_flush(void)
+{
+	unsigned int tail, end, n, max, idx;
+
+	if (evlog.fd < 0 || __atomic_exchange_n(&evlog.flushing, 1, __ATOMIC_ACQUIRE))
+		return;
+	tail = evlog.tail;
+	end = __atomic_load_n(&evlog.head, __ATOMIC_ACQUIRE);
+	while (tail != end) {
+		/* a run of published records, up to the end of the ring */
+		idx = tail % EVLOG_SIZE;
+		max = end - tail < EVLOG_SIZE - idx ? end - tail : EVLOG_SIZE - idx;
+		for (n = 0; n < max; n++)
+			if (__atomic_load_n(&evlog.ring[idx + n].seq, __ATOMIC_ACQUIRE) != tail + n + 1)
+				break;
+		if (n == 0)
+			break;	/* interrupted writer, its record goes out next time */
+		if (write(evlog.fd, &evlog.ring[idx], n * sizeof(struct evlog_rec)) < 0)
+			break;
+		tail += n;
+		__atomic_store_n(&evlog.tail, tail, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&evlog.flushing, 0, __ATOMIC_RELEASE);
+}
+
+static void evlog_atexit(void)
+{
+	evlog_flush();
+	if (evlog.dropped)
+		fprintf(stderr, "evlog: PID = %ld dropped %u events, the ring was full\n",
+			(long)evlog.pid, evlog.dropped);
+}
+
+void evlog_event(int event, pid_t pid, int status)
+{
+	struct timespec ts;
+	struct evlog_rec *r;
+	unsigned int slot;
+
+	if (!evlog_enabled())
+		return;
+	if (__atomic_load_n(&evlog.head, __ATOMIC_RELAXED) -
+	    __atomic_load_n(&evlog.tail, __ATOMIC_ACQUIRE) >= EVLOG_SIZE - EVLOG_SLACK) {
+		evlog_flush();
+		if (evlog.head - evlog.tail >= EVLOG_SIZE - EVLOG_SLACK) {
+			__atomic_fetch_add(&evlog.dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	slot = __atomic_fetch_add(&evlog.head, 1, __ATOMIC_ACQ_REL);
+	r = &evlog.ring[slot % EVLOG_SIZE];
+	r->ts = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	r->pid = evlog.pid;
+	r->child = pid;
+	r->event = event;
+	r->status = status;
+	r->magic = EVLOG_MAGIC;
+	__atomic_store_n(&r->seq, slot + 1, __ATOMIC_RELEASE);
+
+	if (slot + 1 - evlog.tail >= EVLOG_SIZE / 2)
+		evlog_flush();
+}
+
 /*
  * This function receives an integer status value,
  * as returned by wait()/waitpid() and explains what
@@ -66,6 +215,23 @@ change_pname(const char *new_name)
 void
 explain_wait_status(pid_t pid, int status)
 {
+	if (evlog_enabled()) {
+		if (WIFEXITED(status))
+			evlog_event(EV_EXITED, pid, status);
+		else if (WIFSIGNALED(status))
+			evlog_event(EV_SIGNALED, pid, status);
+		else if (WIFSTOPPED(status))
+			evlog_event(EV_STOPPED, pid, status);
+		else if (WIFCONTINUED(status))
+			evlog_event(EV_CONTINUED, pid, status);
+		else {
+			fprintf(stderr, "%s: Internal error: Unhandled case, PID = %ld, status = %d\n",
+				__func__, (long)pid, status);
+			exit(1);
+		}
+		return;
+	}
+
 	if (WIFEXITED(status))
 		fprintf(stderr, "My PID = %ld: Child PID = %ld terminated normally, exit status = %d\n",
 			(long)getpid(), (long)pid, WEXITSTATUS(status));
@@ -110,16 +276,331 @@ wait_for_ready_children(int cnt)
 }
 
 /*
- * Print the process tree rooted at process with PID p.
+ * Child supervision with pidfds.
+ */
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+struct watched_child {
+	pid_t  pid;
+	int    pidfd;	/* -1 on kernels without pidfds, then waitid(P_PID) */
+	int    done;	/* exit reported, nothing more to see */
+};
+
+struct child_watch {
+	int                   epfd;
+	int                   sigfd;
+	sigset_t              oldmask;
+	int                   n, cap;
+	struct watched_child  *c;
+};
+
+struct child_watch *child_watch_create(void)
+{
+	struct child_watch *w;
+	struct epoll_event ev;
+	sigset_t mask;
+
+	w = calloc(1, sizeof(*w));
+	if (w == NULL) {
+		fprintf(stderr, "%s: allocation failed\n", __func__);
+		exit(1);
+	}
+	/* a blocked SIGCHLD stays pending for the signalfd, even with SIG_DFL */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &mask, &w->oldmask) < 0) {
+		perror("child_watch_create: sigprocmask");
+		exit(1);
+	}
+	w->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	w->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (w->sigfd < 0 || w->epfd < 0) {
+		perror("child_watch_create: signalfd/epoll_create1");
+		exit(1);
+	}
+	ev.events = EPOLLIN;
+	ev.data.u64 = (unsigned long long)-1;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->sigfd, &ev) < 0) {
+		perror("child_watch_create: epoll_ctl");
+		exit(1);
+	}
+	return w;
+}
+
+int child_watch_add(struct child_watch *w, pid_t pid)
+{
+	struct watched_child *c;
+	struct epoll_event ev;
+
+	if (w->n == w->cap) {
+		w->cap = w->cap ? 2 * w->cap : 16;
+		w->c = realloc(w->c, w->cap * sizeof(*w->c));
+		if (w->c == NULL) {
+			fprintf(stderr, "%s: allocation failed\n", __func__);
+			exit(1);
+		}
+	}
+	c = &w->c[w->n];
+	c->pid = pid;
+	c->done = 0;
+	c->pidfd = syscall(SYS_pidfd_open, pid, 0);
+	if (c->pidfd < 0 && errno != ENOSYS)
+		return -1;	/* no such child */
+	if (c->pidfd >= 0) {
+		ev.events = EPOLLIN;	/* readable once the child has exited */
+		ev.data.u64 = w->n;
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->pidfd, &ev) < 0) {
+			close(c->pidfd);
+			return -1;
+		}
+	}
+	w->n++;
+	return 0;
+}
+
+int child_watch_fd(struct child_watch *w)
+{
+	return w->epfd;
+}
+
+/* look at every watched child once, without blocking */
+static int child_watch_scan(struct child_watch *w, int want, struct child_state *ev, int max)
+{
+	struct watched_child *c;
+	siginfo_t si;
+	int i, k = 0, ret, flags;
+
+	flags = WEXITED | WNOHANG | (want == CHILD_STOPPED ? WSTOPPED : 0);
+	for (i = 0; i < w->n && k < max; i++) {
+		c = &w->c[i];
+		if (c->done)
+			continue;
+		si.si_pid = 0;
+		if (c->pidfd >= 0)
+			ret = waitid(P_PIDFD, c->pidfd, &si, flags);
+		else
+			ret = waitid(P_PID, c->pid, &si, flags);
+		if (ret < 0 && errno == ECHILD)
+			si.si_code = si.si_pid = -1;	/* not our child, nothing will ever come */
+		else if (ret < 0 || si.si_pid == 0)
+			continue;
+		ev[k].pid = c->pid;
+		switch (si.si_code) {
+		case -1:
+			ev[k].state = CHILD_LOST;
+			ev[k].status = 0;
+			break;
+		case CLD_STOPPED:
+		case CLD_TRAPPED:
+			ev[k].state = CHILD_STOPPED;
+			ev[k].status = (si.si_status << 8) | 0x7f;
+			break;
+		case CLD_EXITED:
+			ev[k].state = CHILD_EXITED;
+			ev[k].status = (si.si_status & 0xff) << 8;
+			break;
+		default:	/* CLD_KILLED, CLD_DUMPED */
+			ev[k].state = CHILD_EXITED;
+			ev[k].status = si.si_status | (si.si_code == CLD_DUMPED ? 0x80 : 0);
+			break;
+		}
+		if (ev[k].state != CHILD_STOPPED) {
+			c->done = 1;
+			if (c->pidfd >= 0) {
+				epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->pidfd, NULL);
+				close(c->pidfd);
+				c->pidfd = -1;
+			}
+		}
+		k++;
+	}
+	return k;
+}
+
+static long now_msec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+int child_watch_poll(struct child_watch *w, int want, struct child_state *ev, int max, int timeout_ms)
+{
+	struct epoll_event events[16];
+	struct signalfd_siginfo ssi;
+	long deadline = now_msec() + timeout_ms, left;
+	int k;
+
+	for (;;) {
+		/* drain SIGCHLDs first, the scan below sees what they were about */
+		while (read(w->sigfd, &ssi, sizeof(ssi)) == sizeof(ssi))
+			;
+		k = child_watch_scan(w, want, ev, max);
+		if (k > 0 || timeout_ms == 0)
+			return k;
+		left = (timeout_ms < 0) ? -1 : deadline - now_msec();
+		if (timeout_ms > 0 && left <= 0)
+			return 0;
+		if (epoll_wait(w->epfd, events, 16, left) < 0 && errno != EINTR) {
+			perror("child_watch_poll: epoll_wait");
+			exit(1);
+		}
+	}
+}
+
+void child_watch_destroy(struct child_watch *w)
+{
+	int i;
+
+	for (i = 0; i < w->n; i++)
+		if (w->c[i].pidfd >= 0)
+			close(w->c[i].pidfd);
+	close(w->sigfd);
+	close(w->epfd);
+	sigprocmask(SIG_SETMASK, &w->oldmask, NULL);
+	free(w->c);
+	free(w);
+}
+
+int wait_for_children(const pid_t *pids, int n, int target, int timeout_ms, struct child_state *res)
+{
+	struct child_watch *w;
+	struct child_state ev;
+	long deadline = now_msec() + timeout_ms, left;
+	int i, pending = n, reached = 0, status;
+
+	w = child_watch_create();
+	for (i = 0; i < n; i++) {
+		res[i].pid = pids[i];
+		res[i].state = CHILD_RUNNING;
+		res[i].status = 0;
+		if (child_watch_add(w, pids[i]) == 0)
+			continue;
+		/* no pidfd: ask waitpid() what it knows, it fails for what is not ours */
+		pending--;
+		if (waitpid(pids[i], &status, WNOHANG | (target == CHILD_STOPPED ? WUNTRACED : 0)) != pids[i]) {
+			res[i].state = CHILD_LOST;
+			continue;
+		}
+		res[i].state = WIFSTOPPED(status) ? CHILD_STOPPED : CHILD_EXITED;
+		res[i].status = status;
+		if (res[i].state == target)
+			reached++;
+	}
+	while (pending > 0) {
+		left = (timeout_ms < 0) ? -1 : deadline - now_msec();
+		if (timeout_ms >= 0 && left < 0)
+			left = 0;
+		if (child_watch_poll(w, target, &ev, 1, left) == 0)
+			break;	/* deadline */
+		for (i = 0; i < n && pids[i] != ev.pid; i++)
+			;
+		if (i == n || res[i].state == target)
+			continue;
+		res[i].state = ev.state;
+		res[i].status = ev.status;
+		if (ev.state == target)
+			reached++;
+		if (ev.state == target || ev.state != CHILD_STOPPED)
+			pending--;	/* there, or never will be */
+	}
+	child_watch_destroy(w);
+	return reached;
+}
+
+/*
+ * Make sure the given children have raised SIGSTOP, within a deadline.
+ * No other child is reaped on the way.
+ */
+void
+wait_for_ready_pids(const pid_t *pids, int n, int timeout_ms)
+{
+	struct child_state *res;
+	int i;
+
+	res = malloc(n * sizeof(*res));
+	if (res == NULL) {
+		fprintf(stderr, "%s: allocation failed\n", __func__);
+		exit(1);
+	}
+	wait_for_children(pids, n, CHILD_STOPPED, timeout_ms, res);
+	for (i = 0; i < n; i++) {
+		if (res[i].state == CHILD_RUNNING) {
+			fprintf(stderr, "Parent: Child with PID %ld not ready after %d ms!\n",
+				(long)res[i].pid, timeout_ms);
+			exit(1);
+		}
+		if (res[i].state == CHILD_LOST) {
+			fprintf(stderr, "Parent: Child with PID %ld cannot be waited for!\n",
+				(long)res[i].pid);
+			exit(1);
+		}
+		explain_wait_status(res[i].pid, res[i].status);
+		if (res[i].state != CHILD_STOPPED) {
+			fprintf(stderr, "Parent: Child with PID %ld has died unexpectedly!\n",
+				(long)res[i].pid);
+			exit(1);
+		}
+	}
+	free(res);
+}
+
+/*
+ * Wait for the given children to terminate, within a deadline.
+ * No other child is reaped on the way.
  */
 void
-show_pstree(pid_t p)
+wait_for_exited_pids(const pid_t *pids, int n, int timeout_ms, int explain)
+{
+	struct child_state *res;
+	int i, failed = 0;
+
+	if (n == 0)
+		return;
+	res = malloc(n * sizeof(*res));
+	if (res == NULL) {
+		fprintf(stderr, "%s: allocation failed\n", __func__);
+		exit(1);
+	}
+	wait_for_children(pids, n, CHILD_EXITED, timeout_ms, res);
+	for (i = 0; i < n; i++) {
+		if (res[i].state == CHILD_EXITED) {
+			if (explain)
+				explain_wait_status(res[i].pid, res[i].status);
+			continue;
+		}
+		if (res[i].state == CHILD_RUNNING) {
+			fprintf(stderr, "Parent: Child with PID %ld still running after %d ms, killing it!\n",
+				(long)res[i].pid, timeout_ms);
+			kill(res[i].pid, SIGKILL);
+		} else {
+			fprintf(stderr, "Parent: Child with PID %ld cannot be waited for!\n",
+				(long)res[i].pid);
+		}
+		failed = 1;
+	}
+	free(res);
+	if (failed)
+		exit(1);
+}
+
+/*
+ * Print the process tree rooted at process with PID p,
+ * with the names of threads instead of their process' name if threads is set.
+ */
+static void
+pstree(pid_t p, int threads)
 {
 	int ret;
 	char cmd[1024];
 
-	snprintf(cmd, sizeof(cmd), "echo; echo; pstree -G -c -p %ld; echo; echo",
-		(long)p);
+	snprintf(cmd, sizeof(cmd), "echo; echo; pstree -G -c -p%s %ld; echo; echo",
+		threads ? " -t" : "", (long)p);
 	cmd[sizeof(cmd)-1] = '\0';
 	ret = system(cmd);
 	if (ret < 0) {
@@ -128,6 +609,18 @@ show_pstree(pid_t p)
 	}
 }
 
+void
+show_pstree(pid_t p)
+{
+	pstree(p, 0);
+}
+
+void
+show_pstree_threads(pid_t p)
+{
+	pstree(p, 1);
+}
+
 
 /*
  * Create a shared memory area, usable by all descendants of the calling process.
@@ -155,3 +648,141 @@ void *create_shared_memory_area(unsigned int numbytes)
 
 	return addr;
 }
+
+
+/*
+ * Shared memory arena.
+ *
+ * Every object is preceded by a 16-byte header holding its size class, which
+ * also links it into the free list of the class while it is free. The head of
+ * each free list packs the offset (in 16-byte units) with a counter that
+ * changes on every update, so that a pop racing with a pop and a push of the
+ * same object (ABA) fails its compare-and-swap instead of corrupting the list.
+ */
+#define SHM_ARENA_ALIGN      16
+#define SHM_ARENA_CLASSES    20		/* 16 bytes .. 8MB, larger objects are never reused */
+#define SHM_ARENA_HUGE_SIZE  (2UL * 1024 * 1024)
+
+struct shm_block {
+	unsigned int   cls;
+	unsigned int   unused;
+	shm_off_t      next;		/* next free object of the class, in 16-byte units */
+};
+
+struct shm_arena {
+	unsigned long  size;
+	unsigned long  top;		/* bump pointer */
+	unsigned long  free_head[SHM_ARENA_CLASSES];	/* tag << 32 | offset / 16 */
+};
+
+static void *shm_arena_map(unsigned long *size, int flags)
+{
+	void *addr;
+
+	if (flags & SHM_ARENA_HUGETLB) {
+		unsigned long huge = (*size + SHM_ARENA_HUGE_SIZE - 1) & ~(SHM_ARENA_HUGE_SIZE - 1);
+
+		addr = mmap(NULL, huge, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (addr != MAP_FAILED) {
+			*size = huge;
+			return addr;
+		}
+		/* no huge pages reserved, normal pages will do */
+	}
+
+	addr = create_shared_memory_area(*size);
+	if (flags & SHM_ARENA_THP)
+		madvise(addr, *size, MADV_HUGEPAGE);	/* only a hint, ignore errors */
+	return addr;
+}
+
+struct shm_arena *shm_arena_create(unsigned int numbytes, int flags)
+{
+	struct shm_arena *arena;
+	unsigned long size = numbytes;
+
+	if (numbytes <= sizeof(struct shm_arena)) {
+		fprintf(stderr, "%s: internal error: arena of %u bytes is too small\n", __func__, numbytes);
+		exit(1);
+	}
+	arena = shm_arena_map(&size, flags);
+	memset(arena, 0, sizeof(*arena));
+	arena->size = size;
+	arena->top = (sizeof(*arena) + SHM_ARENA_ALIGN - 1) & ~(unsigned long)(SHM_ARENA_ALIGN - 1);
+	return arena;
+}
+
+static int shm_arena_class(unsigned long size)
+{
+	int cls = 0;
+
+	while (cls < SHM_ARENA_CLASSES && (SHM_ARENA_ALIGN << cls) < size)
+		cls++;
+	return cls;
+}
+
+shm_off_t shm_arena_alloc(struct shm_arena *arena, unsigned int size)
+{
+	unsigned long total = size + sizeof(struct shm_block);
+	unsigned long head, next, off;
+	struct shm_block *b;
+	int cls = shm_arena_class(total);
+
+	if (cls < SHM_ARENA_CLASSES) {
+		total = SHM_ARENA_ALIGN << cls;
+		/* pop from the free list of the class */
+		head = __atomic_load_n(&arena->free_head[cls], __ATOMIC_ACQUIRE);
+		while ((head & 0xffffffffUL) != 0) {
+			b = (struct shm_block *)((char *)arena + (head & 0xffffffffUL) * SHM_ARENA_ALIGN);
+			next = (head & ~0xffffffffUL) + (1UL << 32) + b->next;
+			if (__atomic_compare_exchange_n(&arena->free_head[cls], &head, next, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				return (char *)(b + 1) - (char *)arena;
+		}
+	} else {
+		total = (total + SHM_ARENA_ALIGN - 1) & ~(unsigned long)(SHM_ARENA_ALIGN - 1);
+	}
+
+	/* nothing to reuse, take fresh memory from the top, only if it fits */
+	off = __atomic_load_n(&arena->top, __ATOMIC_RELAXED);
+	do {
+		if (off + total > arena->size)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&arena->top, &off, off + total, 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	b = (struct shm_block *)((char *)arena + off);
+	b->cls = cls;
+	return off + sizeof(*b);
+}
+
+void shm_arena_free(struct shm_arena *arena, shm_off_t off)
+{
+	struct shm_block *b;
+	unsigned long head, next;
+
+	if (off == 0)
+		return;
+	b = (struct shm_block *)((char *)arena + off) - 1;
+	if (b->cls >= SHM_ARENA_CLASSES)
+		return;		/* huge objects are not reused */
+
+	/* push onto the free list of its class */
+	head = __atomic_load_n(&arena->free_head[b->cls], __ATOMIC_ACQUIRE);
+	do {
+		b->next = head & 0xffffffffUL;
+		next = (head & ~0xffffffffUL) + (1UL << 32) +
+			((char *)b - (char *)arena) / SHM_ARENA_ALIGN;
+	} while (!__atomic_compare_exchange_n(&arena->free_head[b->cls], &head, next, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+}
+
+void *shm_arena_ptr(struct shm_arena *arena, shm_off_t off)
+{
+	return off ? (char *)arena + off : NULL;
+}
+
+shm_off_t shm_arena_off(struct shm_arena *arena, void *ptr)
+{
+	return ptr ? (char *)ptr - (char *)arena : 0;
+}
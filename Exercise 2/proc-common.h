@@ -14,6 +14,7 @@ void wait_forever(void);
 /*
  * Print a nice diagnostic based on {pid, status}
  * as returned by wait() or waitpid().
+ * When the event log is enabled, a binary record is logged instead.
  */
 void explain_wait_status(pid_t pid, int status);
 
@@ -25,15 +26,154 @@ void explain_wait_status(pid_t pid, int status);
  */
 void wait_for_ready_children(int cnt);
 
+/*
+ * Child supervision with pidfds.
+ *
+ * Wait for a given set of children, and only those, to reach a state,
+ * with a deadline. Exits are seen through one pidfd per child, stops through
+ * a signalfd for SIGCHLD, both in one epoll set. SIGCHLD is blocked while a
+ * watch exists. child_watch_fd() can be added to the caller's own
+ * poll()/epoll set, to multiplex child events with other fds.
+ */
+#define CHILD_RUNNING  0	/* not yet in the target state (timeout) */
+#define CHILD_STOPPED  1
+#define CHILD_EXITED   2	/* exited or killed, and reaped */
+#define CHILD_LOST     3	/* cannot be watched or waited for (not ours?), no status */
+
+struct child_state {
+	pid_t  pid;
+	int    state;
+	int    status;		/* as returned by wait(), valid unless CHILD_RUNNING */
+};
+
+struct child_watch;
+
+struct child_watch *child_watch_create(void);
+int child_watch_add(struct child_watch *w, pid_t pid);
+int child_watch_fd(struct child_watch *w);
+
+/*
+ * Collect up to max state changes of watched children, waiting up to
+ * timeout_ms (-1: forever, 0: just look) for the first one. Only stops are
+ * reported if want is CHILD_STOPPED (exits are always reported, and so are
+ * children that turn out not to be ours, as CHILD_LOST). Returns the number
+ * of entries filled in ev[], 0 on timeout.
+ */
+int child_watch_poll(struct child_watch *w, int want, struct child_state *ev, int max, int timeout_ms);
+
+void child_watch_destroy(struct child_watch *w);
+
+/*
+ * Wait until each of the n children in pids[] is in the target state
+ * (CHILD_STOPPED or CHILD_EXITED), or timeout_ms (-1: forever) has passed.
+ * res[i] says where pids[i] ended up, CHILD_LOST if it could not be waited
+ * for at all. Returns the number of children that reached the target state.
+ */
+int wait_for_children(const pid_t *pids, int n, int target, int timeout_ms, struct child_state *res);
+
+/*
+ * Like wait_for_ready_children(), but for the n children in pids[] only,
+ * and giving up after timeout_ms (-1: never).
+ */
+void wait_for_ready_pids(const pid_t *pids, int n, int timeout_ms);
+
+/*
+ * Wait until the n children in pids[] have exited, explaining their exits if
+ * explain is set. Children still running after timeout_ms (-1: never) are
+ * killed, and then so are we.
+ */
+void wait_for_exited_pids(const pid_t *pids, int n, int timeout_ms, int explain);
+
 /* Change the name of the process. */
 void change_pname(const char *new_name);
 
 /* Print the process tree rooted at process with PID p. */
 void show_pstree(pid_t p);
 
+/* The same, each thread under its own name (as set with prctl(PR_SET_NAME)). */
+void show_pstree_threads(pid_t p);
+
 /*
  * Create a shared memory area, usable by all descendants of the calling process.
  */
 void *create_shared_memory_area(unsigned int numbytes);
 
+/******************************************************************************
+ * Shared memory arena
+ *
+ * One shared memory area out of which many small objects are allocated
+ * and freed, by any of the processes forked after its creation. Objects are
+ * named by their offset from the start of the arena rather than by pointers,
+ * so handles can be stored inside shared structures and sent over pipes.
+ * Allocation is lock-free: a bump pointer for fresh memory and one free list
+ * per power-of-two size class, all updated with atomics in the arena header.
+ */
+
+/* offset of an object in its arena, 0 is never a valid object */
+typedef unsigned long shm_off_t;
+
+struct shm_arena;
+
+/* flags for shm_arena_create() */
+#define SHM_ARENA_HUGETLB  0x1	/* try MAP_HUGETLB, fall back to normal pages */
+#define SHM_ARENA_THP      0x2	/* ask for transparent huge pages with madvise() */
+
+/* Create an arena of numbytes, usable by all descendants of the calling process. */
+struct shm_arena *shm_arena_create(unsigned int numbytes, int flags);
+
+/* Allocate size bytes, 16-byte aligned; returns 0 when the arena is full. */
+shm_off_t shm_arena_alloc(struct shm_arena *arena, unsigned int size);
+
+/* Give an object back to the free list of its size class. */
+void shm_arena_free(struct shm_arena *arena, shm_off_t off);
+
+/* Convert between handles and pointers in the calling process. */
+void *shm_arena_ptr(struct shm_arena *arena, shm_off_t off);
+shm_off_t shm_arena_off(struct shm_arena *arena, void *ptr);
+
+/******************************************************************************
+ * Binary event log
+ *
+ * A lock-free ring of fixed-size records, one per process, filled in by
+ * explain_wait_status() without stdio, so it is safe in signal handlers.
+ * Records are appended to the log file when the ring is half full and at
+ * exit(). evlog-dump renders the file as text. The log is enabled with
+ * evlog_open(), or by setting PROC_EVLOG=<file> in the environment, which
+ * evlog_init() reads before main(). Either must happen before any signal
+ * handler that logs is installed.
+ */
+
+/* events */
+enum evlog_event {
+	EV_EXITED = 1,
+	EV_SIGNALED,
+	EV_STOPPED,
+	EV_CONTINUED,
+};
+
+#define EVLOG_MAGIC 0x474c5645	/* "EVLG" */
+
+/* one record, as stored in the file */
+struct evlog_rec {
+	unsigned long long  ts;		/* CLOCK_MONOTONIC, in ns */
+	int                 pid;	/* process that logged the event */
+	int                 child;	/* child the event is about */
+	int                 event;
+	int                 status;	/* as returned by wait() */
+	unsigned int        seq;	/* ring position + 1 once the record is complete */
+	unsigned int        magic;
+};
+
+/* Log to the file at path, appending; returns -1 if it cannot be opened. */
+int evlog_open(const char *path);
+
+/* Open the file named by PROC_EVLOG, if set; runs as a constructor, once. */
+void evlog_init(void);
+
+/* Log an event for child pid; does nothing if the log is not enabled. */
+void evlog_event(int event, pid_t pid, int status);
+
+/* Write out all complete records; also called at exit(). */
+void evlog_flush(void);
+
 #endif /* PROC_COMMON_H */
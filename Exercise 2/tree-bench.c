@@ -0,0 +1,249 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "proc-common.h"
+#include "tree.h"
+#include "expr.h"
+
+/*
+ * Runs a tree program on random trees of growing size.
+ *
+ * For every size a tree is written to a temporary file and the program is run
+ * on it, with the file as its last argument, e.g.
+ *
+ *	./tree-bench -n 10,100,1000 ./ask2_3
+ *	./tree-bench -e -n 100,10000 ./ask2_4 -q
+ *
+ * Reported per size: the time to parse the file (here, with the same code the
+ * programs use), the time of a whole run, the creation time the program prints
+ * itself ("create ... ms", as ask2_3 does), and the largest resident set of
+ * any process of the run. With -e the trees are expressions and the result the
+ * program prints is checked against the one computed here.
+ */
+
+#define BENCH_RUNS      3
+#define LINE_SIZE       1024
+#define VAL_BUF_SIZE    32
+#define MAX_SIZES       32
+
+struct run_stats {
+	double  run_ms;		/* whole run, fork to exit */
+	double  spawn_ms;	/* as printed by the program, < 0 if it does not */
+	long    maxrss_kb;
+	int     result;		/* 1 right, 0 wrong or missing, -1 not checked */
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static double time_parse(const char *path)
+{
+	int r;
+	double t;
+
+	t = now_ms();
+	for (r = 0; r < BENCH_RUNS; r++)
+		free_tree(get_tree_from_file(path));
+	return (now_ms() - t) / BENCH_RUNS;
+}
+
+/*
+ * One run of argv + path, with its stdout and stderr read back here,
+ * looking for the lines we know about.
+ */
+static void run_once(char **argv, int argc, const char *path,
+	const char *expect, struct run_stats *st)
+{
+	char *args[argc + 2], line[LINE_SIZE], got[VAL_BUF_SIZE], *p;
+	int fd[2], status, i;
+	struct rusage ru;
+	FILE *out;
+	pid_t pid;
+	double t, ms;
+
+	for (i = 0; i < argc; i++)
+		args[i] = argv[i];
+	args[argc] = (char *)path;
+	args[argc + 1] = NULL;
+
+	if (pipe(fd)) {
+		perror("pipe");
+		exit(1);
+	}
+	fflush(stdout);
+	t = now_ms();
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		close(fd[0]);
+		if (dup2(fd[1], 1) < 0 || dup2(fd[1], 2) < 0) {
+			perror("dup2");
+			exit(1);
+		}
+		close(fd[1]);
+		execvp(args[0], args);
+		perror(args[0]);
+		exit(1);
+	}
+	close(fd[1]);
+
+	st->spawn_ms = -1;
+	st->result = expect ? 0 : -1;
+	out = fdopen(fd[0], "r");
+	if (out == NULL) {
+		perror("fdopen");
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), out)) {
+		if ((p = strstr(line, "create ")) && sscanf(p, "create %lf ms", &ms) == 1)
+			st->spawn_ms = ms;
+		if (expect && (p = strstr(line, "result is : ")) &&
+		    sscanf(p, "result is : %31s", got) == 1)
+			st->result = !strcmp(got, expect);
+	}
+	fclose(out);
+
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		perror("wait4");
+		exit(1);
+	}
+	st->run_ms = now_ms() - t;
+	/* the children of the run are counted too, once they are reaped */
+	st->maxrss_kb = ru.ru_maxrss;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		explain_wait_status(pid, status);
+		st->result = expect ? 0 : -1;
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n sizes] [-f fanout] [-F fixed|uniform|geometric]\n"
+		"       %*s [-e] [-r seed] program [args...]\n"
+		"  -n sizes   comma separated node counts (default 10,100,1000)\n"
+		"  -f fanout  as for gen-tree, the most children with -e\n"
+		"  -F dist    as for gen-tree\n"
+		"  -e         expressions, and check the printed result\n"
+		"  -r seed    random seed (default 1)\n\n",
+		prog, (int)strlen(prog), "");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, expr = 0, err, r, checked, spawned;
+	unsigned seed = 1, sizes[MAX_SIZES], nr_sizes = 0, s;
+	char *list = "10,100,1000", *tok, path[] = "/tmp/tree-bench-XXXXXX";
+	char buf[VAL_BUF_SIZE];
+	struct tree_shape shape = { 0, 2, FANOUT_FIXED, 0, 0 };
+	struct tree_node *root;
+	struct run_stats st, sum;
+	union expr_value val;
+	FILE *file;
+	int fd;
+
+	/* '+': options end at the program, its own options are passed on */
+	while ((opt = getopt(argc, argv, "+n:f:F:er:")) != -1) {
+		switch (opt) {
+		case 'n':
+			list = optarg;
+			break;
+		case 'f':
+			shape.fanout = strtoul(optarg, NULL, 10);
+			break;
+		case 'F':
+			if (!strcmp(optarg, "fixed"))
+				shape.dist = FANOUT_FIXED;
+			else if (!strcmp(optarg, "uniform"))
+				shape.dist = FANOUT_UNIFORM;
+			else if (!strcmp(optarg, "geometric"))
+				shape.dist = FANOUT_GEOMETRIC;
+			else
+				usage(argv[0]);
+			break;
+		case 'e':
+			expr = 1;
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc || shape.fanout == 0)
+		usage(argv[0]);
+	for (tok = strtok(list, ","); tok && nr_sizes < MAX_SIZES; tok = strtok(NULL, ","))
+		if ((sizes[nr_sizes] = strtoul(tok, NULL, 10)) != 0)
+			nr_sizes++;
+	if (nr_sizes == 0)
+		usage(argv[0]);
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	close(fd);
+
+	printf("%10s %10s %10s %10s %12s %s\n",
+		"nodes", "parse ms", "run ms", "spawn ms", "max rss KB", expr ? "result" : "");
+	for (s = 0; s < nr_sizes; s++) {
+		shape.nr_nodes = sizes[s];
+		if (expr) {
+			root = expr_random_tree(sizes[s], shape.fanout, seed);
+			err = expr_eval_local(root, EXPR_INT64, &val);
+			if (err) {
+				fprintf(stderr, "generated expression fails: %s\n", expr_strerror(err));
+				exit(1);
+			}
+			expr_format(buf, sizeof(buf), EXPR_INT64, val);
+		} else {
+			root = random_tree(&shape, seed);
+		}
+		file = fopen(path, "w");
+		if (file == NULL) {
+			perror(path);
+			exit(1);
+		}
+		write_tree(file, root);
+		if (fclose(file)) {
+			perror(path);
+			exit(1);
+		}
+		free_tree(root);
+
+		memset(&sum, 0, sizeof(sum));
+		checked = spawned = 1;
+		for (r = 0; r < BENCH_RUNS; r++) {
+			run_once(argv + optind, argc - optind, path, expr ? buf : NULL, &st);
+			sum.run_ms += st.run_ms;
+			sum.spawn_ms += st.spawn_ms;
+			if (st.maxrss_kb > sum.maxrss_kb)
+				sum.maxrss_kb = st.maxrss_kb;
+			spawned &= st.spawn_ms >= 0;
+			checked &= st.result == 1;
+		}
+		printf("%10u %10.3f %10.3f ", sizes[s], time_parse(path), sum.run_ms / BENCH_RUNS);
+		if (spawned)
+			printf("%10.3f ", sum.spawn_ms / BENCH_RUNS);
+		else
+			printf("%10s ", "-");
+		printf("%12ld %s\n", sum.maxrss_kb, expr ? (checked ? "ok" : "WRONG") : "");
+		fflush(stdout);
+	}
+	unlink(path);
+	return 0;
+}
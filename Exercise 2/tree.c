@@ -29,6 +29,26 @@ print_tree(struct tree_node *root)
 	__print_tree(root, 0);
 }
 
+static void
+__write_tree(FILE *file, struct tree_node *node)
+{
+	int i;
+
+	fprintf(file, "%s\n%u\n", node->name, node->nr_children);
+	for (i=0; i < node->nr_children; i++)
+		fprintf(file, "%s\n", node->children[i].name);
+	fprintf(file, "\n");
+
+	for (i=0; i < node->nr_children; i++)
+		__write_tree(file, node->children + i);
+}
+
+void
+write_tree(FILE *file, struct tree_node *root)
+{
+	__write_tree(file, root);
+}
+
 static char *
 read_line(FILE *file, char *buff, size_t buff_size)
 {
@@ -169,6 +189,37 @@ parse_node(FILE *file, struct tree_node *node)
 }
 
 
+/*
+ * Trees are read one after the other, so a stream
+ * may hold many of them, e.g. one per request on stdin.
+ */
+struct tree_node *
+get_tree_from_stream(FILE *file)
+{
+	assert(BUFF_SIZE >= NODE_NAME_SIZE);
+	return parse_node(file, NULL);
+}
+
+static void
+free_children(struct tree_node *node)
+{
+	int i;
+	if (node->nr_children == 0)
+		return;	/* ->children is not even set for leaves */
+	for (i=0; i < node->nr_children; i++)
+		free_children(&node->children[i]);
+	free(node->children);
+}
+
+void
+free_tree(struct tree_node *root)
+{
+	if (root == NULL)
+		return;
+	free_children(root);
+	free(root);
+}
+
 struct tree_node *
 get_tree_from_file(const char *filename)
 {
@@ -188,3 +239,114 @@ get_tree_from_file(const char *filename)
 
 	return root;
 }
+
+/*
+ * Random trees, for trying the tree programs on more than a handful of nodes.
+ */
+#define FANOUT_GEOMETRIC_MAX 4096
+
+static unsigned
+draw_fanout(const struct tree_shape *shape, unsigned *seed)
+{
+	unsigned k = 0;
+
+	switch (shape->dist) {
+	case FANOUT_FIXED:
+		return shape->fanout;
+	case FANOUT_UNIFORM:
+		return rand_r(seed) % (2 * shape->fanout + 1);
+	case FANOUT_GEOMETRIC:
+		/* another child with probability fanout / (fanout + 1) */
+		while (k < FANOUT_GEOMETRIC_MAX &&
+		       rand_r(seed) % (shape->fanout + 1) != 0)
+			k++;
+		return k;
+	}
+	return 0;
+}
+
+/* node number id as a name in base 26, padded with 'A' to len */
+static void
+name_node(struct tree_node *node, unsigned id, unsigned len)
+{
+	char buf[NODE_NAME_SIZE];
+	int i = NODE_NAME_SIZE - 1;
+
+	buf[i] = '\0';
+	do {
+		buf[--i] = 'A' + id % 26;
+		id /= 26;
+	} while (id != 0);
+	while (NODE_NAME_SIZE - 1 - i < len)
+		buf[--i] = 'A';
+	snprintf(node->name, NODE_NAME_SIZE, "%s", buf + i);
+}
+
+struct tree_node *
+random_tree(const struct tree_shape *shape, unsigned seed)
+{
+	struct tree_node *root, *node, **queue;
+	unsigned *depth, head, tail, made, k, i, n, d, cap;
+
+	n = shape->nr_nodes;
+	if (n == 0 || shape->fanout == 0 || shape->name_len >= NODE_NAME_SIZE){
+		fprintf(stderr, "random_tree: bad shape\n");
+		exit(1);
+	}
+	/* names of name_len letters must be enough for every node */
+	for (cap = 1, i = 0; i < shape->name_len && cap < n; i++)
+		cap *= 26;
+	if (shape->name_len && cap < n){
+		fprintf(stderr, "random_tree: %u nodes need names longer than %u\n",
+			n, shape->name_len);
+		exit(1);
+	}
+
+	root = calloc(1, sizeof(*root));
+	queue = malloc(n * sizeof(*queue));
+	depth = malloc(n * sizeof(*depth));
+	if (root == NULL || queue == NULL || depth == NULL){
+		fprintf(stderr, "random_tree: allocation failed\n");
+		exit(1);
+	}
+	name_node(root, 0, shape->name_len);
+	queue[0] = root;
+	depth[0] = 0;
+	head = 0;
+	tail = made = 1;
+
+	while (made < n && head < tail){
+		node = queue[head];
+		d = depth[head++];
+		if (shape->max_depth && d >= shape->max_depth)
+			continue;
+		k = draw_fanout(shape, &seed);
+		if (k == 0 && head == tail)
+			k = 1;	/* the last open node must not close the tree */
+		if (k > n - made)
+			k = n - made;
+		if (k == 0)
+			continue;
+
+		node->nr_children = k;
+		node->children = calloc(k, sizeof(struct tree_node));
+		if (node->children == NULL){
+			fprintf(stderr, "random_tree: allocation failed\n");
+			exit(1);
+		}
+		for (i=0; i < k; i++, made++){
+			name_node(node->children + i, made, shape->name_len);
+			queue[tail] = node->children + i;
+			depth[tail++] = d + 1;
+		}
+	}
+	free(queue);
+	free(depth);
+
+	if (made < n){
+		fprintf(stderr, "random_tree: only %u of %u nodes fit in depth %u\n",
+			made, n, shape->max_depth);
+		exit(1);
+	}
+	return root;
+}
@@ -1,6 +1,8 @@
 #ifndef TREE_H
 #define TREE_H
 
+#include <stdio.h>
+
 /******************************************************************************
  * Data structure definitions
  */
@@ -21,6 +23,36 @@ struct tree_node {
 /* returns the root node of the tree defined in a file */
 struct tree_node *get_tree_from_file(const char *filename);
 
+/* reads the next tree from an open stream, NULL at EOF */
+struct tree_node *get_tree_from_stream(FILE *file);
+
+/* frees a tree returned by the functions above */
+void free_tree(struct tree_node *root);
+
 void print_tree(struct tree_node *root);
 
+/* writes a tree in the format read by get_tree_from_file() */
+void write_tree(FILE *file, struct tree_node *root);
+
+/* how many children an internal node gets in random_tree() */
+enum tree_fanout {
+	FANOUT_FIXED,		/* always fanout */
+	FANOUT_UNIFORM,		/* 0 to 2 * fanout */
+	FANOUT_GEOMETRIC,	/* geometric with mean fanout, a few very wide nodes */
+};
+
+struct tree_shape {
+	unsigned          nr_nodes;
+	unsigned          fanout;
+	enum tree_fanout  dist;
+	unsigned          max_depth;	/* 0 for no limit, the root is at depth 0 */
+	unsigned          name_len;	/* 0 for the shortest names that fit */
+};
+
+/*
+ * A random tree of exactly shape->nr_nodes nodes with unique names,
+ * grown breadth first. Exits if the nodes do not fit under max_depth.
+ */
+struct tree_node *random_tree(const struct tree_shape *shape, unsigned seed);
+
 #endif /* TREE_H */
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include "workload.h"
+
+#define WL_BUF_SIZE      (64UL * 1024 * 1024)	/* well above any last level cache */
+#define WL_CALIB_NSEC    5000000UL		/* a batch of at least 5ms decides */
+#define WL_CALIB_RUNS    3			/* batches of that size, the fastest counts */
+#define WL_CPU_UNIT      1000			/* iterations */
+#define WL_MEM_UNIT      (64 * 1024)		/* bytes streamed */
+#define WL_CACHE_UNIT    256			/* dependent loads */
+#define WL_IO_UNIT       4096			/* bytes written and synced */
+
+static const char *names[WL_NR_PROFILES] = { "cpu", "mem", "cache", "io" };
+
+/* nanoseconds per unit of work, 0 until calibrated */
+static double unit_nsec[WL_NR_PROFILES];
+
+/* state of the profiles, carried from one unit to the next */
+static unsigned long *buf;		/* WL_MEM and WL_CACHE */
+static unsigned long mem_pos, chase_pos;
+static int io_fd = -1;
+static volatile unsigned long sink;	/* keeps the results alive */
+
+static unsigned long
+now_nsec(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void
+setup_buffer(void)
+{
+	unsigned long n = WL_BUF_SIZE / sizeof(*buf), i, j, t;
+	unsigned int seed = 1;
+
+	if (buf != NULL)
+		return;
+	buf = malloc(WL_BUF_SIZE);
+	if (buf == NULL) {
+		perror("workload: malloc");
+		exit(1);
+	}
+	/* Sattolo's shuffle: one random cycle through all the entries */
+	for (i = 0; i < n; i++)
+		buf[i] = i;
+	for (i = n - 1; i > 0; i--) {
+		j = (((unsigned long)rand_r(&seed) << 31) ^ rand_r(&seed)) % i;
+		t = buf[i];
+		buf[i] = buf[j];
+		buf[j] = t;
+	}
+}
+
+static void
+setup_io(void)
+{
+	char path[] = "/tmp/workload-XXXXXX";
+
+	if (io_fd >= 0)
+		return;
+	io_fd = mkstemp(path);
+	if (io_fd < 0) {
+		perror("workload: mkstemp");
+		exit(1);
+	}
+	unlink(path);	/* gone as soon as we exit */
+}
+
+static void
+cpu_units(unsigned long units)
+{
+	unsigned long i, x = sink | 1;
+
+	for (i = 0; i < units * WL_CPU_UNIT; i++)
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+	sink = x;
+}
+
+static void
+mem_units(unsigned long units)
+{
+	unsigned long n = WL_BUF_SIZE / sizeof(*buf);
+	volatile unsigned long *vbuf = buf;
+	unsigned long i, k, v, sum = 0;
+
+	for (k = 0; k < units; k++) {
+		for (i = 0; i < WL_MEM_UNIT / sizeof(*buf); i++) {
+			v = vbuf[mem_pos];
+			sum += v;
+			/* a write too, the line goes back dirty; the same value, the cycle lives here */
+			vbuf[mem_pos] = v;
+			mem_pos = (mem_pos + 1 == n) ? 0 : mem_pos + 1;
+		}
+	}
+	sink = sum;
+}
+
+static void
+cache_units(unsigned long units)
+{
+	unsigned long i, p = chase_pos;
+
+	for (i = 0; i < units * WL_CACHE_UNIT; i++)
+		p = buf[p];	/* every load needs the one before it */
+	chase_pos = p;
+}
+
+static void
+io_units(unsigned long units)
+{
+	static char block[WL_IO_UNIT];
+	unsigned long k;
+
+	for (k = 0; k < units; k++) {
+		if (pwrite(io_fd, block, sizeof(block), 0) != sizeof(block)) {
+			perror("workload: pwrite");
+			exit(1);
+		}
+		if (fdatasync(io_fd) < 0) {
+			perror("workload: fdatasync");
+			exit(1);
+		}
+	}
+}
+
+static void
+run_units(enum workload_profile profile, unsigned long units)
+{
+	switch (profile) {
+	case WL_CPU:
+		cpu_units(units);
+		break;
+	case WL_MEM:
+		mem_units(units);
+		break;
+	case WL_CACHE:
+		cache_units(units);
+		break;
+	case WL_IO:
+		io_units(units);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Run batches of doubling size until one takes long enough
+ * to be measured reliably, then divide the fastest of a few of that size.
+ */
+void
+workload_calibrate(enum workload_profile profile)
+{
+	unsigned long units, t, best;
+	int r;
+	/* CPU time, so that a stop or a preemption does not count; I/O waits do */
+	clockid_t clock = (profile == WL_IO) ? CLOCK_MONOTONIC : CLOCK_THREAD_CPUTIME_ID;
+
+	if (profile >= WL_NR_PROFILES || unit_nsec[profile] > 0)
+		return;
+	if (profile == WL_MEM || profile == WL_CACHE)
+		setup_buffer();
+	if (profile == WL_IO)
+		setup_io();
+
+	run_units(profile, 1);	/* warm up */
+	for (units = 1; ; units *= 2) {
+		t = now_nsec(clock);
+		run_units(profile, units);
+		t = now_nsec(clock) - t;
+		if (t >= WL_CALIB_NSEC || units >= (1UL << 40))
+			break;
+	}
+	/* a stop in the middle of one batch only makes that one slower */
+	for (best = t, r = 1; r < WL_CALIB_RUNS; r++) {
+		t = now_nsec(clock);
+		run_units(profile, units);
+		t = now_nsec(clock) - t;
+		if (t < best)
+			best = t;
+	}
+	unit_nsec[profile] = (double)best / units;
+	if (unit_nsec[profile] <= 0)
+		unit_nsec[profile] = 1;
+}
+
+void
+workload_run(enum workload_profile profile, unsigned long usec)
+{
+	if (profile >= WL_NR_PROFILES || usec == 0)
+		return;
+	workload_calibrate(profile);
+	run_units(profile, (unsigned long)(usec * 1000.0 / unit_nsec[profile] + 0.5));
+}
+
+const char *
+workload_name(enum workload_profile profile)
+{
+	return profile < WL_NR_PROFILES ? names[profile] : "?";
+}
+
+int
+workload_parse(const char *spec, struct workload *wl)
+{
+	const char *colon = strchr(spec, ':');
+	size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+	char *end;
+	int i;
+
+	for (i = 0; i < WL_NR_PROFILES; i++)
+		if (strlen(names[i]) == len && strncmp(spec, names[i], len) == 0)
+			break;
+	if (i == WL_NR_PROFILES)
+		return -1;
+	wl->profile = i;
+	if (colon) {
+		wl->usec = strtoul(colon + 1, &end, 10);
+		if (end == colon + 1 || *end != '\0')
+			return -1;
+	}
+	return 0;
+}
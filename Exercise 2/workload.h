@@ -0,0 +1,40 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+/******************************************************************************
+ * Synthetic workloads
+ *
+ * Unlike compute(), which spins for a fixed number of iterations, a workload
+ * is asked for in microseconds. Every profile measures its unit of work the
+ * first time it is used, so the same request costs about the same time on
+ * any machine and with any compiler. The amount of work is fixed after
+ * calibration: a process that is stopped or preempted finishes later,
+ * it does not do less work.
+ */
+
+enum workload_profile {
+	WL_CPU,		/* arithmetic in registers */
+	WL_MEM,		/* streaming reads and writes over a buffer larger than the caches */
+	WL_CACHE,	/* dependent loads chasing a random cycle through that buffer */
+	WL_IO,		/* small writes to a temporary file, each followed by fdatasync() */
+	WL_NR_PROFILES
+};
+
+struct workload {
+	enum workload_profile  profile;
+	unsigned long          usec;
+};
+
+/* Parse "profile" or "profile:usec", e.g. "cache:2000"; returns -1 if invalid. */
+int workload_parse(const char *spec, struct workload *wl);
+
+/* Name of a profile, as accepted by workload_parse(). */
+const char *workload_name(enum workload_profile profile);
+
+/* Calibrate a profile now instead of on its first use. */
+void workload_calibrate(enum workload_profile profile);
+
+/* Do about usec microseconds worth of work of the given profile. */
+void workload_run(enum workload_profile profile, unsigned long usec);
+
+#endif /* WORKLOAD_H */
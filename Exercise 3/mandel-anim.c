@@ -0,0 +1,571 @@
+/*
+ * mandel-anim.c
+ *
+ * Zoom animations of the Mandelbrot Set: a path of keyframes, and every
+ * frame on the way an image file, or a PPM on a stream, all drawn by one
+ * pool of threads that lives as long as the animation.
+ *
+ * The frames go through a pipeline of FRAME_SLOTS buffers:
+ *
+ *   main     sets a frame up (its view, the reference orbit of a deep zoom)
+ *            as soon as a slot is free, ahead of the workers;
+ *   workers  take tiles off one shared counter that runs through all the
+ *            frames, so a worker done with the tiles of frame N goes straight
+ *            on to N + 1 while the last ones of N are still being drawn;
+ *   writer   colors, compresses and writes every finished frame, in order,
+ *            and frees its slot.
+ *
+ * So frame N + 1 is computed while frame N is encoded and written, and no
+ * thread is started, and no prompt waited for, between frames.
+ *
+ * With -C, the frames doubles resolve are drawn through a cache of tiles
+ * (mandel-cache.c): their corners snap to the lattice of their step, and
+ * where the path pans or holds still, the tiles already drawn are reused.
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mandel-lib.h"
+#include "mandel-image.h"
+#include "mandel-deep.h"
+#include "mandel-cache.h"
+
+#define FRAME_SLOTS 3	/* one being set up, one drawn, one written */
+#define MAX_PATH_LEN 4096
+
+#define perror_pthread(ret, msg) \
+	do { errno = ret; perror(msg); } while (0)
+
+/*
+ * A keyframe: the center, the width of the view and the iteration limit,
+ * and how many frames it takes to get there from the one before.
+ */
+struct keyframe {
+	char    *cx, *cy;	/* decimal, as many digits as it takes */
+	double  width;
+	int     max;
+	int     frames;
+};
+
+struct frame_slot {
+	int                 index;
+	int                 max;
+	int                 precision;
+	double              xmin, ymax;	/* deep: offsets from the reference */
+	double              xstep, ystep;
+	double              *xcoord;
+	int                 cached;		/* -C: tiles of the lattice, from i0, j0 */
+	long                i0, j0;
+	struct mandel_deep  *deep;
+	int                 *iters;		/* height x width iteration counts */
+	long                tiles_left;
+	int                 done;		/* all tiles in, over to the writer */
+};
+
+struct {
+	pthread_mutex_t    lock;
+	pthread_cond_t     changed;	/* a frame was set up, drawn or written */
+	int                nr_frames;
+	int                published;	/* frames 0 to published - 1 are set up */
+	int                written;	/* frames 0 to written - 1 are out, their slots free */
+	long               next_tile;	/* through all the frames, nr_tiles each */
+	struct frame_slot  slot[FRAME_SLOTS];
+} anim;
+
+struct worker {
+	pthread_t  tid;
+	double     busy_ms, idle_ms;
+};
+
+int width = 1920, height = 1080;
+int tile_rows = 16, tile_cols = 256;
+int tiles_per_row, nr_tiles;
+int lattice_per_row;			/* -C: lattice tiles across a frame, at most */
+
+struct mandel_cache *cache;
+
+struct keyframe *keys;
+int nr_keys;
+
+const char *out_prefix, *out_suffix;	/* around the frame number */
+int out_digits, out_format;
+int out_stream;				/* -o -: PPMs to standard output */
+
+double writer_busy_ms, writer_idle_ms, setup_ms;
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* lines of "re,im width max_iter frames", # comments; exits on a bad one */
+static void read_keyframes(const char *path)
+{
+	FILE *f;
+	char *line = NULL, *p, *center, *comma, *end;
+	size_t cap = 0;
+	int lineno = 0, k;
+	struct keyframe *kf;
+
+	f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+	while (getline(&line, &cap, f) > 0) {
+		lineno++;
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		center = strtok(line, " \t\n");
+		if (center == NULL)
+			continue;
+		keys = realloc(keys, (nr_keys + 1) * sizeof(*keys));
+		if (keys == NULL) {
+			fprintf(stderr, "keyframes: out of memory\n");
+			exit(1);
+		}
+		kf = &keys[nr_keys++];
+		comma = strchr(center, ',');
+		if (comma == NULL)
+			goto bad;
+		*comma = '\0';
+		kf->cx = strdup(center);
+		kf->cy = strdup(comma + 1);
+		if ((p = strtok(NULL, " \t\n")) == NULL)
+			goto bad;
+		kf->width = strtod(p, &end);
+		if (*end || !(kf->width > 0))
+			goto bad;
+		if ((p = strtok(NULL, " \t\n")) == NULL || (kf->max = atoi(p)) < 1)
+			goto bad;
+		/* the first keyframe is where the path starts, it takes no frames */
+		p = strtok(NULL, " \t\n");
+		kf->frames = p ? atoi(p) : 0;
+		if ((nr_keys > 1 && kf->frames < 1) || strtok(NULL, " \t\n"))
+			goto bad;
+	}
+	free(line);
+	if (f != stdin)
+		fclose(f);
+	if (nr_keys == 0) {
+		fprintf(stderr, "%s: no keyframes\n", path);
+		exit(1);
+	}
+	for (anim.nr_frames = 1, k = 1; k < nr_keys; k++)
+		anim.nr_frames += keys[k].frames;
+	return;
+bad:
+	fprintf(stderr, "%s:%d: expected re,im width max_iter frames\n", path, lineno);
+	exit(1);
+}
+
+/*
+ * Frame f of the path, between keyframes a and b: the width goes
+ * geometrically, which is a steady zoom, and the center by the same share
+ * of the width's way, so that what is zoomed into stays put on the screen.
+ */
+static void setup_frame(struct frame_slot *s, int f)
+{
+	const struct keyframe *a = &keys[0], *b = &keys[0];
+	double t = 0, w, h, share, x, y;
+	char *cx, *cy;
+	int k, i;
+
+	for (k = 1; f > 0 && k < nr_keys; f -= keys[k++].frames)
+		if (f <= keys[k].frames) {
+			a = &keys[k - 1];
+			b = &keys[k];
+			t = (double)f / b->frames;
+			break;
+		}
+
+	w = t == 1 ? b->width : a->width * pow(b->width / a->width, t);
+	h = w * height / width;
+	share = a->width == b->width ? t : (w - a->width) / (b->width - a->width);
+	if (share < 0)
+		share = 0;
+	if (share > 1)
+		share = 1;
+	cx = mandel_deep_lerp(a->cx, b->cx, share, w / width);
+	cy = mandel_deep_lerp(a->cy, b->cy, share, w / width);
+	x = strtod(cx, NULL);
+	y = strtod(cy, NULL);
+
+	s->max = lround(a->max + t * (b->max - a->max));
+	s->deep = NULL;
+	/* the same choice as mandel.c: perturbation past double, float while it will do */
+	if (mandel_deep_needed(x, y, fmin(w / width, h / height))) {
+		s->deep = mandel_deep_create(cx, cy, fmin(w / width, h / height), s->max);
+		x = y = 0;
+	}
+	/* the corners and steps as mandel.c works them out */
+	s->xmin = x - w / 2;
+	s->ymax = y + h / 2;
+	s->xstep = (x + w / 2 - s->xmin) / width;
+	s->ystep = (s->ymax - (y - h / 2)) / height;
+	if (!s->deep)
+		s->precision = mandel_precision_for(fmax(fabs(s->xmin), fabs(x + w / 2)),
+			fmax(fabs(s->ymax), fabs(y - h / 2)), fmin(s->xstep, s->ystep), s->max);
+	/* -C: the top left pixel on the lattice, within half a step */
+	s->cached = cache && !s->deep;
+	if (s->cached) {
+		s->xstep = s->ystep = w / width;
+		s->i0 = lround(s->xmin / s->xstep);
+		s->j0 = lround(-s->ymax / s->ystep);
+	}
+	for (x = s->xmin, i = 0; i < width; x += s->xstep, i++)
+		s->xcoord[i] = x;
+	free(cx);
+	free(cy);
+}
+
+/* a tile of frame s, row after row as mandel.c draws them */
+static void draw_tile(struct frame_slot *s, int tile)
+{
+	int band = tile / tiles_per_row, c0, c1, line, last;
+	int *out;
+	double y;
+
+	c0 = tile % tiles_per_row * tile_cols;
+	c1 = c0 + tile_cols < width ? c0 + tile_cols : width;
+	last = band * tile_rows + tile_rows < height ? band * tile_rows + tile_rows : height;
+	for (line = band * tile_rows; line < last; line++) {
+		y = s->ymax - s->ystep * line;
+		out = s->iters + (size_t)line * width + c0;
+		if (s->deep)
+			mandel_deep_iterations_at_points(s->deep, s->xcoord + c0, y, c1 - c0, out);
+		else
+			mandel_iterations_at_points_prec(s->precision, s->xcoord + c0, y, c1 - c0,
+				s->max, out);
+	}
+}
+
+static long floor_div(long a, long b)
+{
+	return a / b - (a % b < 0);
+}
+
+/* -C: the part of lattice tile number tile that frame s shows, through the cache */
+static void draw_cached_tile(struct frame_slot *s, int tile)
+{
+	int iters[MANDEL_CACHE_SIDE * MANDEL_CACHE_SIDE];
+	long tx, ty;
+	int x0, y0, c0, c1, line;
+
+	tx = floor_div(s->i0, MANDEL_CACHE_SIDE) + tile % lattice_per_row;
+	ty = floor_div(s->j0, MANDEL_CACHE_SIDE) + tile / lattice_per_row;
+	/* where the tile's corner falls in the frame, maybe left of or above it */
+	x0 = tx * MANDEL_CACHE_SIDE - s->i0;
+	y0 = ty * MANDEL_CACHE_SIDE - s->j0;
+	if (x0 >= width || y0 >= height)
+		return;
+	mandel_cache_tile(cache, s->xstep, s->ystep, tx, ty, s->max, iters);
+
+	c0 = x0 < 0 ? -x0 : 0;
+	c1 = x0 + MANDEL_CACHE_SIDE < width ? MANDEL_CACHE_SIDE : width - x0;
+	for (line = y0 < 0 ? -y0 : 0; line < MANDEL_CACHE_SIDE && y0 + line < height; line++)
+		memcpy(s->iters + (size_t)(y0 + line) * width + x0 + c0,
+			iters + line * MANDEL_CACHE_SIDE + c0, (c1 - c0) * sizeof(int));
+}
+
+static void *anim_worker(void *arg)
+{
+	struct worker *me = arg;
+	struct frame_slot *s;
+	long task;
+	int f;
+	double t;
+
+	for (;;) {
+		task = __atomic_fetch_add(&anim.next_tile, 1, __ATOMIC_RELAXED);
+		f = task / nr_tiles;
+		if (f >= anim.nr_frames)
+			return NULL;
+
+		/* ahead of main: wait for the frame to be set up */
+		if (__atomic_load_n(&anim.published, __ATOMIC_ACQUIRE) <= f) {
+			t = now_ms();
+			pthread_mutex_lock(&anim.lock);
+			while (anim.published <= f)
+				pthread_cond_wait(&anim.changed, &anim.lock);
+			pthread_mutex_unlock(&anim.lock);
+			me->idle_ms += now_ms() - t;
+		}
+
+		s = &anim.slot[f % FRAME_SLOTS];
+		t = now_ms();
+		/* the tasks of a frame are as many as the more of either kind of tile */
+		if (s->cached)
+			draw_cached_tile(s, task % nr_tiles);
+		else if (task % nr_tiles < tiles_per_row * ((height + tile_rows - 1) / tile_rows))
+			draw_tile(s, task % nr_tiles);
+		me->busy_ms += now_ms() - t;
+
+		/* acq_rel: whoever draws the last tile sees all the others */
+		if (__atomic_sub_fetch(&s->tiles_left, 1, __ATOMIC_ACQ_REL) == 0) {
+			pthread_mutex_lock(&anim.lock);
+			s->done = 1;
+			pthread_cond_broadcast(&anim.changed);
+			pthread_mutex_unlock(&anim.lock);
+		}
+	}
+}
+
+static void write_frame(const struct frame_slot *s)
+{
+	struct mandel_image *img;
+	char path[MAX_PATH_LEN];
+	int line;
+
+	if (out_stream) {
+		mandel_image_stream(1, width, height, s->iters);
+		return;
+	}
+	snprintf(path, sizeof(path), "%s%0*d%s", out_prefix, out_digits, s->index, out_suffix);
+	img = mandel_image_create(path, width, height, out_format);
+	for (line = 0; line < height; line++)
+		mandel_image_put(img, line, 0, width, s->iters + (size_t)line * width);
+	mandel_image_close(img);
+}
+
+static void *anim_writer(void *arg)
+{
+	struct frame_slot *s;
+	int f;
+	double t;
+
+	for (f = 0; f < anim.nr_frames; f++) {
+		s = &anim.slot[f % FRAME_SLOTS];
+		t = now_ms();
+		pthread_mutex_lock(&anim.lock);
+		while (anim.published <= f || !s->done)
+			pthread_cond_wait(&anim.changed, &anim.lock);
+		pthread_mutex_unlock(&anim.lock);
+		writer_idle_ms += now_ms() - t;
+
+		t = now_ms();
+		write_frame(s);
+		if (s->deep)
+			mandel_deep_destroy(s->deep);
+		writer_busy_ms += now_ms() - t;
+
+		pthread_mutex_lock(&anim.lock);
+		anim.written = f + 1;
+		pthread_cond_broadcast(&anim.changed);
+		pthread_mutex_unlock(&anim.lock);
+	}
+	return NULL;
+}
+
+/* "frame%04d.png": what goes before and after the number, and its width */
+static int parse_pattern(char *pattern)
+{
+	char *pct = strchr(pattern, '%'), *end;
+
+	if (!strcmp(pattern, "-")) {
+		out_stream = 1;
+		return 0;
+	}
+	if (pct == NULL)
+		return -1;
+	out_digits = strtol(pct + 1, &end, 10);
+	if (*end != 'd' || out_digits < 0 || out_digits > 20 || strchr(end, '%'))
+		return -1;
+	*pct = '\0';
+	out_prefix = pattern;
+	out_suffix = end + 1;
+	out_format = mandel_image_format_of(out_suffix);
+	return out_format < 0 ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	int k;
+
+	fprintf(stderr, "Usage: %s [-j threads] [-W width] [-H height] [-T rowsxcols]\n"
+		"       [-C megabytes] [-p palette] -o pattern keyframes\n"
+		"  keyframes   a file (- for standard input) of lines\n"
+		"                re,im width max_iter frames\n"
+		"              the center of the view, as many digits as it takes, its\n"
+		"              width, the iteration limit, and the frames it takes to\n"
+		"              get there from the line before (none on the first line)\n"
+		"  -o pattern  a file per frame, e.g. frame%%05d.ppm, .pfm"
+#ifdef HAVE_ZLIB
+		" or .png"
+#endif
+		",\n"
+		"              or - for a stream of PPMs on standard output\n"
+		"  -j threads  drawing threads (default: one per CPU)\n"
+		"  -W, -H      size of a frame in pixels (default 1920x1080)\n"
+		"  -T RxC      tiles of R lines by C columns (default 16x256)\n"
+		"  -C MB       keep up to MB of %dx%d tiles to reuse where the path\n"
+		"              pans or holds; the view snaps to whole steps\n"
+		"  -p palette  one of:", prog, MANDEL_CACHE_SIDE, MANDEL_CACHE_SIDE);
+	for (k = 0; mandel_palette_name(k); k++)
+		fprintf(stderr, " %s", mandel_palette_name(k));
+	fprintf(stderr, "\n\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, nthreads, i, ret;
+	struct worker *workers;
+	pthread_t writer;
+	char *pattern = NULL;
+	const char *palette = "classic";
+	double t, busy = 0, idle = 0, cache_mb = 0;
+	struct mandel_cache_stats st;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "j:W:H:T:C:p:o:")) != -1) {
+		switch (opt) {
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		case 'T':
+			if (sscanf(optarg, "%dx%d", &tile_rows, &tile_cols) != 2 ||
+			    tile_rows < 1 || tile_cols < 1)
+				usage(argv[0]);
+			break;
+		case 'C':
+			cache_mb = atof(optarg);
+			if (!(cache_mb > 0))
+				usage(argv[0]);
+			break;
+		case 'p':
+			palette = optarg;
+			break;
+		case 'o':
+			pattern = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || pattern == NULL || parse_pattern(pattern) < 0 ||
+	    nthreads < 1 || width < 1 || height < 1 || mandel_set_palette(palette, 0) < 0)
+		usage(argv[0]);
+	read_keyframes(argv[optind]);
+
+	tiles_per_row = (width + tile_cols - 1) / tile_cols;
+	nr_tiles = (height + tile_rows - 1) / tile_rows * tiles_per_row;
+	if (cache_mb > 0) {
+		/* a frame starting anywhere in a lattice tile spans one more */
+		cache = mandel_cache_create(cache_mb * 1024 * 1024);
+		lattice_per_row = (width - 1) / MANDEL_CACHE_SIDE + 2;
+		if (nr_tiles < lattice_per_row * ((height - 1) / MANDEL_CACHE_SIDE + 2))
+			nr_tiles = lattice_per_row * ((height - 1) / MANDEL_CACHE_SIDE + 2);
+	}
+	for (i = 0; i < FRAME_SLOTS; i++) {
+		anim.slot[i].iters = malloc((size_t)width * height * sizeof(int));
+		anim.slot[i].xcoord = malloc(width * sizeof(double));
+		if (!anim.slot[i].iters || !anim.slot[i].xcoord) {
+			fprintf(stderr, "frames: out of memory\n");
+			exit(1);
+		}
+	}
+	pthread_mutex_init(&anim.lock, NULL);
+	pthread_cond_init(&anim.changed, NULL);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	t = now_ms();
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_create(&workers[i].tid, NULL, anim_worker, &workers[i]);
+		if (ret) {
+			perror_pthread(ret, "pthread_create");
+			exit(1);
+		}
+	}
+	ret = pthread_create(&writer, NULL, anim_writer, NULL);
+	if (ret) {
+		perror_pthread(ret, "pthread_create");
+		exit(1);
+	}
+
+	/* set every frame up as soon as its slot is written out */
+	for (i = 0; i < anim.nr_frames; i++) {
+		struct frame_slot *s = &anim.slot[i % FRAME_SLOTS];
+		double t0;
+
+		pthread_mutex_lock(&anim.lock);
+		while (i - anim.written >= FRAME_SLOTS)
+			pthread_cond_wait(&anim.changed, &anim.lock);
+		pthread_mutex_unlock(&anim.lock);
+
+		t0 = now_ms();
+		setup_frame(s, i);
+		s->index = i;
+		s->tiles_left = nr_tiles;
+		s->done = 0;
+		setup_ms += now_ms() - t0;
+
+		pthread_mutex_lock(&anim.lock);
+		__atomic_store_n(&anim.published, i + 1, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&anim.changed);
+		pthread_mutex_unlock(&anim.lock);
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(workers[i].tid, NULL);
+		if (ret)
+			perror_pthread(ret, "pthread_join");
+		busy += workers[i].busy_ms;
+		idle += workers[i].idle_ms;
+	}
+	ret = pthread_join(writer, NULL);
+	if (ret)
+		perror_pthread(ret, "pthread_join");
+	t = now_ms() - t;
+
+	/* per frame, who held the pipeline up: drawing, setting up or writing */
+	fprintf(stderr, "%d frames of %dx%d in %.3f s: %.2f fps\n", anim.nr_frames,
+		width, height, t / 1000, anim.nr_frames * 1000 / t);
+	fprintf(stderr, "per frame: draw %.3f thread-ms (%d threads, idle %.1f%%), set up %.3f ms, "
+		"write %.3f ms (writer idle %.1f%%)\n", busy / anim.nr_frames, nthreads,
+		busy + idle > 0 ? 100 * idle / (busy + idle) : 0.0, setup_ms / anim.nr_frames,
+		writer_busy_ms / anim.nr_frames,
+		t > 0 ? 100 * writer_idle_ms / t : 0.0);
+	if (cache) {
+		mandel_cache_get_stats(cache, &st);
+		fprintf(stderr, "cache: %ld of %ld tiles reused (%.1f%%), %ld evicted, %.1f MB held\n",
+			st.hits, st.hits + st.misses,
+			st.hits + st.misses ? 100.0 * st.hits / (st.hits + st.misses) : 0.0,
+			st.evictions, st.bytes / 1048576.0);
+		mandel_cache_destroy(cache);
+	}
+
+	pthread_mutex_destroy(&anim.lock);
+	pthread_cond_destroy(&anim.changed);
+	for (i = 0; i < FRAME_SLOTS; i++) {
+		free(anim.slot[i].iters);
+		free(anim.slot[i].xcoord);
+	}
+	for (i = 0; i < nr_keys; i++) {
+		free(keys[i].cx);
+		free(keys[i].cy);
+	}
+	free(keys);
+	free(workers);
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * mandel-bench.c
+ *
+ * Checks the vectorized kernels against mandel_iterations_at_point()
+ * and times each of them over a whole frame, with and without the
+ * shortcuts for interior points. The double kernels must match exactly;
+ * the float ones round differently, so only a share of points, near the
+ * boundary, may differ.
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mandel-lib.h"
+
+#define BENCH_RUNS 3
+
+/* the view of mandel.c, at a finer grid */
+int x_points = 800;
+int y_points = 400;
+int max_iter = 10000;
+double tolerance = 1.0;	/* percent of points a float kernel may get wrong */
+
+double xmin = -1.8, xmax = 1.0;
+double ymin = -1.0, ymax = 1.0;
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* iteration counts of the whole frame, row after row, with the current kernel */
+static void compute_frame(const double *xs, int *iters)
+{
+	double ystep = (ymax - ymin) / y_points;
+	int line;
+
+	for (line = 0; line < y_points; line++)
+		mandel_iterations_at_points(xs, ymax - ystep * line, x_points,
+			max_iter, iters + (size_t)line * x_points);
+}
+
+/*
+ * Time one kernel in one precision against the reference counts,
+ * print its row, and return whether it got too many points wrong.
+ */
+static int bench_kernel(const char *name, int prec, int checks, const double *xs,
+	const int *ref, int *iters, long long total, double t_scalar)
+{
+	const char *pname = prec == MANDEL_FLOAT ? "float" : "double";
+	size_t nr_points = (size_t)x_points * y_points, i, bad;
+	double t;
+	int r;
+
+	if (mandel_set_kernel(name) < 0) {
+		printf("%-8s %6s %9s %10s\n", name, pname, checks ? "on" : "off", "n/a");
+		return 0;
+	}
+	mandel_set_precision(prec);
+	t = now_ms();
+	for (r = 0; r < BENCH_RUNS; r++)
+		compute_frame(xs, iters);
+	t = (now_ms() - t) / BENCH_RUNS;
+	mandel_set_precision(MANDEL_DOUBLE);
+
+	/* with the checks, only points on the bulbs' boundary may differ */
+	for (bad = 0, i = 0; i < nr_points; i++)
+		if (iters[i] != ref[i]) {
+			if (!bad && prec == MANDEL_DOUBLE)
+				fprintf(stderr, "%s: point (%zu, %zu) took %d iterations, not %d\n",
+					name, i % x_points, i / x_points, iters[i], ref[i]);
+			bad++;
+		}
+	/* Miter/s counts the iterations of the plain loop, i.e. the work saved */
+	printf("%-8s %6s %9s %10.3f %10.1f %7.2fx %10zu\n", name, pname, checks ? "on" : "off",
+		t, total / t / 1000.0, t_scalar / t, bad);
+
+	if (prec == MANDEL_DOUBLE)
+		return bad != 0;
+	if (bad * 100.0 > tolerance * nr_points) {
+		fprintf(stderr, "%s: float got %zu of %zu points wrong, over %g%%\n",
+			name, bad, nr_points, tolerance);
+		return 1;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-x points] [-y points] [-m max_iter] [-k kernel] [-t percent]\n"
+		"  -x, -y     size of the grid (default 800 x 400)\n"
+		"  -m         iteration limit (default 10000)\n"
+		"  -k kernel  only this kernel: avx512, avx2, sse2 or scalar\n"
+		"  -t percent points the float kernels may get wrong (default 1)\n\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, k, r, checks, prec, failed = 0;
+	const char *only = NULL, *name;
+	double *xs, x, xstep, t_scalar = 0;
+	int *ref, *iters;
+	size_t nr_points, i;
+	long long total = 0;
+
+	while ((opt = getopt(argc, argv, "x:y:m:k:t:")) != -1) {
+		switch (opt) {
+		case 'x':
+			x_points = atoi(optarg);
+			break;
+		case 'y':
+			y_points = atoi(optarg);
+			break;
+		case 'm':
+			max_iter = atoi(optarg);
+			break;
+		case 'k':
+			only = optarg;
+			break;
+		case 't':
+			tolerance = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || x_points < 1 || y_points < 1 || max_iter < 1 || tolerance < 0)
+		usage(argv[0]);
+
+	nr_points = (size_t)x_points * y_points;
+	xs = malloc(x_points * sizeof(*xs));
+	ref = malloc(nr_points * sizeof(*ref));
+	iters = malloc(nr_points * sizeof(*iters));
+	if (!xs || !ref || !iters) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	xstep = (xmax - xmin) / x_points;
+	for (x = xmin, i = 0; i < x_points; x += xstep, i++)
+		xs[i] = x;
+
+	/*
+	 * The reference is the plain escape time loop, one point at a time,
+	 * which is also the time to beat.
+	 */
+	printf("default kernel: %s, in %s here\n", mandel_kernel_name(),
+		mandel_precision_for(xmin, ymax, xstep, max_iter) == MANDEL_FLOAT ? "float" : "double");
+	mandel_set_kernel("scalar");
+	mandel_set_interior_checks(0);
+	t_scalar = now_ms();
+	for (r = 0; r < BENCH_RUNS; r++)
+		compute_frame(xs, ref);
+	t_scalar = (now_ms() - t_scalar) / BENCH_RUNS;
+	for (i = 0; i < nr_points; i++)
+		total += ref[i];
+
+	printf("%-8s %6s %9s %10s %10s %8s %10s\n", "kernel", "prec", "interior", "ms/frame",
+		"Miter/s", "speedup", "mismatches");
+	for (checks = 0; checks <= 1; checks++) {
+		mandel_set_interior_checks(checks);
+		for (k = 0; (name = mandel_kernel_at(k)) != NULL; k++) {
+			if (only && strcmp(only, name))
+				continue;
+			for (prec = MANDEL_DOUBLE; prec >= MANDEL_FLOAT; prec--)
+				failed |= bench_kernel(name, prec, checks, xs, ref, iters, total, t_scalar);
+		}
+	}
+
+	free(xs);
+	free(ref);
+	free(iters);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * mandel-cache.c
+ *
+ * Tiles of iteration counts, by (xstep, ystep, tx, ty, max), in a hash
+ * table of chains, and on a list from the most to the least recently asked for,
+ * whose far end is evicted to stay in budget. One lock for all of it: it
+ * is only held to look a tile up or put it in, never while one is drawn.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "mandel-lib.h"
+#include "mandel-cache.h"
+
+#define SIDE MANDEL_CACHE_SIDE
+
+struct tile {
+	double       xstep, ystep;
+	long         tx, ty;
+	int          max;
+	struct tile  *next;		/* in its hash chain */
+	struct tile  *newer, *older;	/* on the LRU list */
+	int          iters[SIDE * SIDE];
+};
+
+struct mandel_cache {
+	pthread_mutex_t  lock;
+	size_t           budget;
+	struct tile      **chains;
+	unsigned long    mask;		/* chains has mask + 1 of them, a power of 2 */
+	struct tile      *newest, *oldest;
+	struct mandel_cache_stats  st;
+};
+
+struct mandel_cache *mandel_cache_create(size_t budget)
+{
+	struct mandel_cache *c;
+	unsigned long n;
+
+	/* about one tile per chain when full */
+	for (n = 16; n < budget / sizeof(struct tile); n *= 2)
+		;
+	c = calloc(1, sizeof(*c));
+	if (c == NULL || (c->chains = calloc(n, sizeof(*c->chains))) == NULL) {
+		fprintf(stderr, "mandel_cache_create: out of memory\n");
+		exit(1);
+	}
+	c->mask = n - 1;
+	c->budget = budget;
+	pthread_mutex_init(&c->lock, NULL);
+	return c;
+}
+
+void mandel_cache_destroy(struct mandel_cache *c)
+{
+	struct tile *t, *older;
+
+	for (t = c->newest; t != NULL; t = older) {
+		older = t->older;
+		free(t);
+	}
+	pthread_mutex_destroy(&c->lock);
+	free(c->chains);
+	free(c);
+}
+
+static unsigned long tile_hash(double xstep, double ystep, long tx, long ty, int max)
+{
+	uint64_t h, sx, sy;
+
+	memcpy(&sx, &xstep, sizeof(sx));
+	memcpy(&sy, &ystep, sizeof(sy));
+	h = (sx ^ sy << 1) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (uint64_t)tx) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (uint64_t)ty) * 0x94d049bb133111ebULL;
+	h = (h ^ (uint64_t)max) * 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 31);
+}
+
+static struct tile **tile_find(struct mandel_cache *c, double xstep, double ystep,
+	long tx, long ty, int max)
+{
+	struct tile **p = &c->chains[tile_hash(xstep, ystep, tx, ty, max) & c->mask];
+
+	for (; *p != NULL; p = &(*p)->next)
+		if ((*p)->xstep == xstep && (*p)->ystep == ystep && (*p)->tx == tx &&
+		    (*p)->ty == ty && (*p)->max == max)
+			break;
+	return p;
+}
+
+static void lru_unlink(struct mandel_cache *c, struct tile *t)
+{
+	if (t->newer)
+		t->newer->older = t->older;
+	else
+		c->newest = t->older;
+	if (t->older)
+		t->older->newer = t->newer;
+	else
+		c->oldest = t->newer;
+}
+
+static void lru_push(struct mandel_cache *c, struct tile *t)
+{
+	t->newer = NULL;
+	t->older = c->newest;
+	if (c->newest)
+		c->newest->newer = t;
+	else
+		c->oldest = t;
+	c->newest = t;
+}
+
+/* the points of the tile, each as one product of a step: the same in any view */
+static void tile_draw(double xstep, double ystep, long tx, long ty, int max, int *iters)
+{
+	double xs[SIDE], x0, x1, y0, y1;
+	int i, j, prec;
+
+	for (i = 0; i < SIDE; i++)
+		xs[i] = (tx * SIDE + i) * xstep;
+	x0 = xs[0];
+	x1 = xs[SIDE - 1];
+	y0 = -(ty * SIDE) * ystep;
+	y1 = -(ty * SIDE + SIDE - 1) * ystep;
+	prec = mandel_precision_for(fmax(fabs(x0), fabs(x1)), fmax(fabs(y0), fabs(y1)),
+		fmin(xstep, ystep), max);
+	for (j = 0; j < SIDE; j++)
+		mandel_iterations_at_points_prec(prec, xs, -(ty * SIDE + j) * ystep, SIDE, max,
+			iters + j * SIDE);
+}
+
+int mandel_cache_tile(struct mandel_cache *c, double xstep, double ystep, long tx, long ty,
+	int max, int *iters)
+{
+	struct tile **p, *t, *victim;
+
+	pthread_mutex_lock(&c->lock);
+	p = tile_find(c, xstep, ystep, tx, ty, max);
+	if ((t = *p) != NULL) {
+		lru_unlink(c, t);
+		lru_push(c, t);
+		memcpy(iters, t->iters, sizeof(t->iters));
+		c->st.hits++;
+		pthread_mutex_unlock(&c->lock);
+		return 1;
+	}
+	c->st.misses++;
+	pthread_mutex_unlock(&c->lock);
+
+	tile_draw(xstep, ystep, tx, ty, max, iters);
+	t = malloc(sizeof(*t));
+	if (t == NULL) {
+		fprintf(stderr, "mandel_cache_tile: out of memory\n");
+		exit(1);
+	}
+	t->xstep = xstep;
+	t->ystep = ystep;
+	t->tx = tx;
+	t->ty = ty;
+	t->max = max;
+	memcpy(t->iters, iters, sizeof(t->iters));
+
+	pthread_mutex_lock(&c->lock);
+	/* someone else may have drawn it meanwhile */
+	p = tile_find(c, xstep, ystep, tx, ty, max);
+	if (*p != NULL) {
+		pthread_mutex_unlock(&c->lock);
+		free(t);
+		return 0;
+	}
+	t->next = NULL;
+	*p = t;
+	lru_push(c, t);
+	c->st.bytes += sizeof(*t);
+	while (c->st.bytes > c->budget && c->oldest) {
+		victim = c->oldest;
+		lru_unlink(c, victim);
+		p = tile_find(c, victim->xstep, victim->ystep, victim->tx, victim->ty, victim->max);
+		*p = victim->next;
+		c->st.bytes -= sizeof(*victim);
+		c->st.evictions++;
+		free(victim);
+	}
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+}
+
+void mandel_cache_get_stats(struct mandel_cache *c, struct mandel_cache_stats *st)
+{
+	pthread_mutex_lock(&c->lock);
+	*st = c->st;
+	pthread_mutex_unlock(&c->lock);
+}
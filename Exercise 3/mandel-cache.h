@@ -0,0 +1,48 @@
+/*
+ * mandel-cache.h
+ *
+ * Iteration counts of square tiles of the plane, kept from one frame to
+ * the next.
+ *
+ * A tile is named by the steps between its points and its place on the
+ * lattice of those steps: lattice point (i, j) is the point (i xstep,
+ * -j ystep), and tile (tx, ty) holds the points tx * MANDEL_CACHE_SIDE to
+ * tx * MANDEL_CACHE_SIDE + MANDEL_CACHE_SIDE - 1 across, the same for ty
+ * down. Two views at the same steps whose corners are lattice points share
+ * the tiles they overlap, wherever their centers are: a view that pans only
+ * draws the tiles it uncovers. For views that doubles resolve; deep ones
+ * have a lattice of their own around every reference.
+ *
+ */
+
+#ifndef MANDEL_CACHE_H__
+#define MANDEL_CACHE_H__
+
+#include <stddef.h>
+
+#define MANDEL_CACHE_SIDE 32	/* small enough for a terminal's worth of cells */
+
+struct mandel_cache;
+
+struct mandel_cache_stats {
+	long    hits, misses, evictions;
+	size_t  bytes;		/* held by the tiles now */
+};
+
+/* A cache that keeps up to budget bytes of tiles, exits on failure. */
+struct mandel_cache *mandel_cache_create(size_t budget);
+void mandel_cache_destroy(struct mandel_cache *c);
+
+/*
+ * The counts of tile (tx, ty) at the steps, with limit max, row after row into
+ * iters (MANDEL_CACHE_SIDE squared of them): the kept ones, or drawn and
+ * kept, in float where it will do. Returns 1 if they were kept. Any number
+ * of threads can ask at once; over budget, the tiles asked for longest ago
+ * go first.
+ */
+int mandel_cache_tile(struct mandel_cache *c, double xstep, double ystep, long tx, long ty,
+	int max, int *iters);
+
+void mandel_cache_get_stats(struct mandel_cache *c, struct mandel_cache_stats *st);
+
+#endif /* MANDEL_CACHE_H__ */
@@ -0,0 +1,484 @@
+/*
+ * mandel-deep.c
+ *
+ * Deep zooms by perturbation.
+ *
+ * Doubles run out at zooms of about 1e-13: neighbouring points are no longer
+ * neighbouring doubles. But the orbits of neighbouring points stay close to
+ * each other, so one reference orbit Z is computed with as many bits as the
+ * zoom needs, and every point c = C + dc follows only its offset from it,
+ * dz = z - Z, which is small and fits a double at any zoom:
+ *
+ *	dz' = (2 Z + dz) dz + dc
+ *
+ * Where the offset grows as large as z itself (z passes near 0) the
+ * reference stops being a good base for it: the rounding of Z + dz eats the
+ * bits that tell the points apart, and whole patches come out flat, the
+ * glitches of perturbation. That is caught with |Z + dz| < |dz| and the point
+ * is rebased on the reference's own start: dz becomes z, and the reference
+ * starts over from Z = 0 (Zhuoran). The same happens when the reference has
+ * escaped, so any point will do as the reference, and one is enough.
+ *
+ * The reference is computed in fixed point: 64 bits of integer part and as
+ * many 64-bit limbs of fraction as the zoom needs, plus one to spare.
+ *
+ * With the avx512 kernel of mandel-simd.c, 8 points go at once here too,
+ * each lane at its own place in the reference orbit.
+ *
+ */
+
+/* the same roundings in the avx512 lanes as in deep_point() */
+#pragma GCC optimize ("fp-contract=off")
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+
+#include "mandel-lib.h"
+#include "mandel-deep.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define MP_LIMBS 20		/* offsets in doubles end at 1e-308 anyway */
+#define DEEP_ULPS_PER_STEP 4096	/* doubles are fine with this many to a step */
+
+/* sign and magnitude; l[0] to l[n - 2] the fraction, l[n - 1] the integer part */
+struct mp {
+	int       neg;
+	uint64_t  l[MP_LIMBS];
+};
+
+struct mandel_deep {
+	double  cx, cy;		/* the reference, rounded, for the bulb test */
+	int     max;
+	int     len;		/* Z[0] to Z[len] */
+	double  *zx, *zy;	/* the reference orbit, rounded */
+	long    rebases;
+};
+
+static int mp_cmp_mag(const struct mp *a, const struct mp *b, int n)
+{
+	int i;
+
+	for (i = n - 1; i >= 0; i--)
+		if (a->l[i] != b->l[i])
+			return a->l[i] < b->l[i] ? -1 : 1;
+	return 0;
+}
+
+/* r = a + b, for any signs; r may be a or b */
+static void mp_add(struct mp *r, const struct mp *a, const struct mp *b, int n)
+{
+	const struct mp *big = a, *small = b;
+	unsigned __int128 s;
+	uint64_t borrow = 0, carry = 0;
+	int i, neg;
+
+	if (a->neg == b->neg) {
+		for (i = 0; i < n; i++) {
+			s = (unsigned __int128)a->l[i] + b->l[i] + carry;
+			r->l[i] = s;
+			carry = s >> 64;
+		}
+		r->neg = a->neg;
+		return;
+	}
+	if (mp_cmp_mag(a, b, n) < 0) {
+		big = b;
+		small = a;
+	}
+	neg = big->neg;
+	for (i = 0; i < n; i++) {
+		s = (unsigned __int128)big->l[i] - small->l[i] - borrow;
+		r->l[i] = s;
+		borrow = (s >> 64) != 0;
+	}
+	r->neg = neg;
+}
+
+/* r = a * b, the bits below the last limb dropped; r may be a or b */
+static void mp_mul(struct mp *r, const struct mp *a, const struct mp *b, int n)
+{
+	uint64_t p[2 * MP_LIMBS] = { 0 };
+	unsigned __int128 s;
+	uint64_t carry;
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		carry = 0;
+		for (j = 0; j < n; j++) {
+			s = (unsigned __int128)a->l[i] * b->l[j] + p[i + j] + carry;
+			p[i + j] = s;
+			carry = s >> 64;
+		}
+		p[i + n] = carry;
+	}
+	r->neg = a->neg ^ b->neg;
+	memcpy(r->l, p + n - 1, n * sizeof(uint64_t));
+}
+
+static double mp_to_double(const struct mp *a, int n)
+{
+	double v = 0;
+	int i;
+
+	/* the top 3 limbs are more than a double holds */
+	for (i = n - 3 > 0 ? n - 3 : 0; i < n; i++)
+		v += ldexp((double)a->l[i], 64 * (i - (n - 1)));
+	return a->neg ? -v : v;
+}
+
+/* [-]digits[.digits][e[-]digits], -1 if s is not a number in range */
+static int mp_parse(struct mp *r, const char *s, int n)
+{
+	char digits[strlen(s) + 1];
+	int nr = 0, point = -1, exp = 0, i, k;
+	unsigned __int128 t;
+	uint64_t rem, integer;
+	char *end;
+
+	memset(r, 0, sizeof(*r));
+	if (*s == '-' || *s == '+')
+		r->neg = *s++ == '-';
+	for (; *s; s++) {
+		if (*s >= '0' && *s <= '9')
+			digits[nr++] = *s - '0';
+		else if (*s == '.' && point < 0)
+			point = nr;
+		else
+			break;
+	}
+	if (nr == 0)
+		return -1;
+	if (*s == 'e' || *s == 'E') {
+		exp = strtol(s + 1, &end, 10);
+		s = end;
+	}
+	if (*s || exp > 1000 || exp < -1000)
+		return -1;
+	point = (point < 0 ? nr : point) + exp;	/* digits before the point */
+
+	/* the integer part, at most 18 digits */
+	for (i = 0; i < point; i++) {
+		if (i >= 18)
+			return -1;
+		r->l[n - 1] = r->l[n - 1] * 10 + (i < nr ? digits[i] : 0);
+	}
+	/*
+	 * The fraction from its last digit up, f = (f + d) / 10, with the
+	 * integer limb as scratch; with the point left of the digits,
+	 * zeros come in between.
+	 */
+	integer = r->l[n - 1];
+	r->l[n - 1] = 0;
+	for (i = nr - 1; i >= point; i--) {
+		r->l[n - 1] = i >= 0 ? digits[i] : 0;
+		for (rem = 0, k = n - 1; k >= 0; k--) {
+			t = (unsigned __int128)rem << 64 | r->l[k];
+			r->l[k] = t / 10;
+			rem = t % 10;
+		}
+	}
+	r->l[n - 1] = integer;
+	return 0;
+}
+
+int mandel_deep_needed(double x, double y, double step)
+{
+	double m = fmax(fmax(fabs(x), fabs(y)), 1.0);
+
+	return step < DEEP_ULPS_PER_STEP * DBL_EPSILON * m;
+}
+
+struct mandel_deep *mandel_deep_create(const char *cx, const char *cy, double step, int max)
+{
+	struct mandel_deep *d;
+	struct mp c[2], x, y, xx, yy, xy;
+	int n, i;
+	double zx, zy;
+
+	/* the bits below the step, and one limb more */
+	if (!(step > 1e-300) || max < 1) {
+		fprintf(stderr, "mandel_deep_create: steps of %g are beyond doubles\n", step);
+		exit(1);
+	}
+	n = 1 + (int)ceil(-log2(step < 1 ? step : 1) / 64) + 1;
+	if (n > MP_LIMBS)
+		n = MP_LIMBS;
+	if (mp_parse(&c[0], cx, n) < 0 || mp_parse(&c[1], cy, n) < 0) {
+		fprintf(stderr, "mandel_deep_create: bad point %s, %s\n", cx, cy);
+		exit(1);
+	}
+
+	d = calloc(1, sizeof(*d));
+	if (d == NULL || (d->zx = malloc((max + 1) * sizeof(double))) == NULL ||
+	    (d->zy = malloc((max + 1) * sizeof(double))) == NULL) {
+		fprintf(stderr, "mandel_deep_create: out of memory\n");
+		exit(1);
+	}
+	d->max = max;
+	d->cx = mp_to_double(&c[0], n);
+	d->cy = mp_to_double(&c[1], n);
+
+	memset(&x, 0, sizeof(x));
+	memset(&y, 0, sizeof(y));
+	d->zx[0] = d->zy[0] = 0;
+	for (i = 1; i <= max; i++) {
+		mp_mul(&xx, &x, &x, n);
+		mp_mul(&yy, &y, &y, n);
+		mp_mul(&xy, &x, &y, n);
+		yy.neg = !yy.neg;
+		mp_add(&x, &xx, &yy, n);
+		mp_add(&x, &x, &c[0], n);
+		mp_add(&y, &xy, &xy, n);
+		mp_add(&y, &y, &c[1], n);
+		d->zx[i] = zx = mp_to_double(&x, n);
+		d->zy[i] = zy = mp_to_double(&y, n);
+		if (zx * zx + zy * zy > 4)
+			break;
+	}
+	d->len = i <= max ? i : max;
+	return d;
+}
+
+void mandel_deep_destroy(struct mandel_deep *d)
+{
+	free(d->zx);
+	free(d->zy);
+	free(d);
+}
+
+/* as mandel_iterations_at_point(): the z before the first one past 2 */
+static int deep_point(const struct mandel_deep *d, double dcx, double dcy, long *rebases)
+{
+	const double *zx = d->zx, *zy = d->zy;
+	double dx = 0, dy = 0, x, y, r, tx, ty, t;
+	int k, m = 0;
+
+	/* rounding only matters within rounding of the bulbs' boundary */
+	if (mandel_interior_checks() && mandel_in_main_bulbs(d->cx + dcx, d->cy + dcy))
+		return d->max;
+
+	for (k = 0; ; k++) {
+		x = zx[m] + dx;
+		y = zy[m] + dy;
+		r = x * x + y * y;
+		if (r > 4)
+			return k - 1;
+		if (k == d->max)
+			return d->max;
+		if (r < dx * dx + dy * dy || m == d->len) {
+			dx = x;
+			dy = y;
+			m = 0;
+			(*rebases)++;
+		}
+		tx = 2 * zx[m] + dx;
+		ty = 2 * zy[m] + dy;
+		t = tx * dx - ty * dy + dcx;
+		dy = tx * dy + ty * dx + dcy;
+		dx = t;
+		m++;
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* deep_point() in 8 lanes; past n the lanes repeat the last point */
+__attribute__((target("avx512f")))
+static void deep_points_avx512(const struct mandel_deep *d, const double *dx, int ddx,
+	const double *dy, int ddy, int n, int *iters, long *rebases)
+{
+	const __m512d four = _mm512_set1_pd(4.0), one = _mm512_set1_pd(1.0);
+	const __m512d zero = _mm512_setzero_pd();
+	const __m512i len = _mm512_set1_epi64(d->len), step = _mm512_set1_epi64(1);
+	__m512d dcx, dcy, zx, zy, refx, refy, x, y, r, tx, ty, t, cnt;
+	__m512i m;
+	__mmask8 active, esc, reb;
+	double lx[8], ly[8], c[8];
+	int i, k, l, j, checks = mandel_interior_checks();
+
+	for (i = 0; i < n; i += 8) {
+		active = 0;
+		for (l = 0; l < 8; l++) {
+			j = i + l < n ? i + l : n - 1;
+			lx[l] = dx[j * ddx];
+			ly[l] = dy[j * ddy];
+			if (checks && mandel_in_main_bulbs(d->cx + lx[l], d->cy + ly[l])) {
+				c[l] = d->max;
+			} else {
+				c[l] = -1;
+				active |= 1u << l;
+			}
+		}
+		dcx = _mm512_loadu_pd(lx);
+		dcy = _mm512_loadu_pd(ly);
+		cnt = _mm512_loadu_pd(c);
+		zx = zy = zero;
+		m = _mm512_setzero_si512();
+		for (k = 0; active; k++) {
+			refx = _mm512_mask_i64gather_pd(zero, active, m, d->zx, 8);
+			refy = _mm512_mask_i64gather_pd(zero, active, m, d->zy, 8);
+			x = _mm512_add_pd(refx, zx);
+			y = _mm512_add_pd(refy, zy);
+			r = _mm512_add_pd(_mm512_mul_pd(x, x), _mm512_mul_pd(y, y));
+			esc = _mm512_mask_cmp_pd_mask(active, r, four, _CMP_GT_OQ);
+			active &= ~esc;
+			cnt = _mm512_mask_add_pd(cnt, active, cnt, one);
+			if (k == d->max)
+				break;
+
+			/* the glitch test, or the end of the reference: start it over */
+			reb = _mm512_mask_cmp_pd_mask(active, r, _mm512_add_pd(_mm512_mul_pd(zx, zx),
+				_mm512_mul_pd(zy, zy)), _CMP_LT_OQ);
+			reb |= _mm512_mask_cmpeq_epi64_mask(active, m, len);
+			if (reb) {
+				/* Z[0] is 0 */
+				zx = _mm512_mask_mov_pd(zx, reb, x);
+				zy = _mm512_mask_mov_pd(zy, reb, y);
+				refx = _mm512_mask_mov_pd(refx, reb, zero);
+				refy = _mm512_mask_mov_pd(refy, reb, zero);
+				m = _mm512_mask_mov_epi64(m, reb, _mm512_setzero_si512());
+				*rebases += __builtin_popcount(reb);
+			}
+
+			/* dz = (2 Z + dz) dz + dc */
+			tx = _mm512_add_pd(_mm512_add_pd(refx, refx), zx);
+			ty = _mm512_add_pd(_mm512_add_pd(refy, refy), zy);
+			t = _mm512_add_pd(_mm512_sub_pd(_mm512_mul_pd(tx, zx), _mm512_mul_pd(ty, zy)), dcx);
+			zy = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(tx, zy), _mm512_mul_pd(ty, zx)), dcy);
+			zx = t;
+			m = _mm512_mask_add_epi64(m, active, m, step);
+		}
+		_mm512_storeu_pd(c, cnt);
+		for (l = 0; l < 8 && i + l < n; l++)
+			iters[i + l] = c[l];
+	}
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+/* the points of mandel_deep_iterations_at_*(), with the kernel mandel-simd.c uses */
+static void deep_points(struct mandel_deep *d, const double *dx, int ddx,
+	const double *dy, int ddy, int n, int *iters)
+{
+	long rebases = 0;
+	int i;
+
+#ifdef HAVE_X86_KERNELS
+	if (!strcmp(mandel_kernel_name(), "avx512"))
+		deep_points_avx512(d, dx, ddx, dy, ddy, n, iters, &rebases);
+	else
+#endif
+	for (i = 0; i < n; i++)
+		iters[i] = deep_point(d, dx[i * ddx], dy[i * ddy], &rebases);
+	__atomic_add_fetch(&d->rebases, rebases, __ATOMIC_RELAXED);
+}
+
+void mandel_deep_iterations_at_points(struct mandel_deep *d, const double *dx, double dy,
+	int n, int *iters)
+{
+	deep_points(d, dx, 1, &dy, 0, n, iters);
+}
+
+void mandel_deep_iterations_at_xy(struct mandel_deep *d, const double *dx, const double *dy,
+	int n, int *iters)
+{
+	deep_points(d, dx, 1, dy, 1, n, iters);
+}
+
+/* r in decimal, down to step and a double's worth under it; malloc()ed */
+static char *mp_print(struct mp *r, int n, double step)
+{
+	int digits, i, k;
+	unsigned __int128 t;
+	uint64_t carry;
+	char *out, *p;
+
+	/* the limbs hold about 19 digits each */
+	digits = (step < 1 ? (int)ceil(-log10(step)) : 0) + 20;
+	if (digits > 19 * (n - 1))
+		digits = 19 * (n - 1);
+	out = malloc(digits + 24);
+	if (out == NULL) {
+		fprintf(stderr, "mandel_deep: out of memory\n");
+		exit(1);
+	}
+	p = out + sprintf(out, "%s%llu.", r->neg ? "-" : "", (unsigned long long)r->l[n - 1]);
+	/* the fraction times 10, the digit is what carries into the integer part */
+	for (i = 0; i < digits; i++) {
+		for (carry = 0, k = 0; k < n - 1; k++) {
+			t = (unsigned __int128)r->l[k] * 10 + carry;
+			r->l[k] = t;
+			carry = t >> 64;
+		}
+		*p++ = '0' + carry;
+	}
+	*p = '\0';
+	return out;
+}
+
+/* a double, exactly: 53 bits, at most 3 limbs of the fixed point */
+static int mp_from_double(struct mp *r, double v, int n)
+{
+	double m = fabs(v), limb;
+	int i;
+
+	memset(r, 0, sizeof(*r));
+	r->neg = v < 0;
+	if (!(m < 0x1p63))
+		return -1;
+	for (i = n - 1; i >= 0 && m > 0; i--) {
+		limb = floor(m);
+		r->l[i] = (uint64_t)limb;
+		m = ldexp(m - limb, 64);
+	}
+	return 0;
+}
+
+char *mandel_deep_lerp(const char *a, const char *b, double s, double step)
+{
+	struct mp pa, pb, ps, r;
+	int n = MP_LIMBS;
+
+	if (mp_parse(&pa, a, n) < 0 || mp_parse(&pb, b, n) < 0 || !(s >= 0 && s <= 1)) {
+		fprintf(stderr, "mandel_deep_lerp: bad point %s or %s\n", a, b);
+		exit(1);
+	}
+	mp_from_double(&ps, s, n);
+	pa.neg = !pa.neg;
+	mp_add(&r, &pb, &pa, n);
+	mp_mul(&r, &r, &ps, n);
+	pa.neg = !pa.neg;
+	mp_add(&r, &r, &pa, n);
+	return mp_print(&r, n, step);
+}
+
+char *mandel_deep_offset(const char *a, double d, double step)
+{
+	struct mp pa, pd;
+	int n = MP_LIMBS;
+
+	if (mp_parse(&pa, a, n) < 0 || mp_from_double(&pd, d, n) < 0) {
+		fprintf(stderr, "mandel_deep_offset: bad point %s or offset %g\n", a, d);
+		exit(1);
+	}
+	mp_add(&pa, &pa, &pd, n);
+	return mp_print(&pa, n, step);
+}
+
+int mandel_deep_orbit_length(const struct mandel_deep *d)
+{
+	return d->len;
+}
+
+long mandel_deep_rebases(const struct mandel_deep *d)
+{
+	return __atomic_load_n(&d->rebases, __ATOMIC_RELAXED);
+}
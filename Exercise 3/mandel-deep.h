@@ -0,0 +1,52 @@
+/*
+ * mandel-deep.h
+ *
+ * Deep zooms of the Mandelbrot Set: one reference orbit in multiprecision,
+ * every point as a double precision offset from it (perturbation).
+ *
+ */
+
+#ifndef MANDEL_DEEP_H__
+#define MANDEL_DEEP_H__
+
+struct mandel_deep;
+
+/*
+ * Do doubles still tell apart points step apart around (x, y)?
+ * If not, the view needs mandel_deep.
+ */
+int mandel_deep_needed(double x, double y, double step);
+
+/*
+ * The reference orbit of the point cx + i cy, given as decimal strings of
+ * any length (e.g. "-0.7436438870371587047521915061"), with enough bits to
+ * resolve offsets of step, up to max iterations. Exits on a bad number.
+ */
+struct mandel_deep *mandel_deep_create(const char *cx, const char *cy, double step, int max);
+void mandel_deep_destroy(struct mandel_deep *d);
+
+/*
+ * Iteration counts of the n points (cx + dx[i], cy + dy), or (cx + dx[i],
+ * cy + dy[i]), counted as mandel_iterations_at_point() does. Any number of
+ * threads can use the same reference at once.
+ */
+void mandel_deep_iterations_at_points(struct mandel_deep *d, const double *dx, double dy,
+	int n, int *iters);
+void mandel_deep_iterations_at_xy(struct mandel_deep *d, const double *dx, const double *dy,
+	int n, int *iters);
+
+/*
+ * The point a + s (b - a) of the segment from a to b (decimal strings, s in
+ * [0, 1]), worked out in multiprecision and given to a double's worth of
+ * digits below step: a path between two deep zooms. The string is malloc()ed.
+ */
+char *mandel_deep_lerp(const char *a, const char *b, double s, double step);
+
+/* a + d the same way: a view that pans by d, at any depth */
+char *mandel_deep_offset(const char *a, double d, double step);
+
+/* iterations of the reference before it escaped (max if it did not), and rebases so far */
+int mandel_deep_orbit_length(const struct mandel_deep *d);
+long mandel_deep_rebases(const struct mandel_deep *d);
+
+#endif /* MANDEL_DEEP_H__ */
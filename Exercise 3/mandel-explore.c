@@ -0,0 +1,667 @@
+/*
+ * mandel-explore.c
+ *
+ * Explore the Mandelbrot Set in a terminal, with the keyboard: pan, zoom
+ * (past doubles too, by perturbation) and change the iteration limit, in a
+ * picture as large as the terminal, whatever size it is resized to.
+ *
+ * Every view is drawn by a pool of threads that lives as long as the
+ * program, in two passes over tiles of the lattice of mandel-cache.h: one
+ * point for every COARSE_BLOCK x COARSE_BLOCK cells first, then every
+ * cell. Meanwhile the main thread waits for keys and, every REFRESH_MS,
+ * sends the terminal only the cells whose color has changed since the last
+ * time, each run of them after a cursor move: the picture sharpens in
+ * place, and a key stops it for the next view at once. Tiles of views
+ * doubles resolve are kept in a cache, so a view that pans draws only the
+ * cells it uncovers, and one zoomed back out to is there at once.
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "mandel-lib.h"
+#include "mandel-deep.h"
+#include "mandel-cache.h"
+
+#define CELL_ASPECT   2		/* a cell is about twice as high as it is wide */
+#define COARSE_BLOCK  4		/* cells per point of the first pass, each way */
+#define REFRESH_MS    40
+#define PAN_PARTS     8		/* a key pans by this part of the picture */
+#define SIDE          MANDEL_CACHE_SIDE
+
+#define perror_pthread(ret, msg) \
+	do { errno = ret; perror(msg); } while (0)
+
+/*
+ * What is shown: the center, as many digits as it takes, the width of a
+ * cell on the plane (its height is CELL_ASPECT times that), and the limit.
+ */
+struct view {
+	char    *cx, *cy;
+	double  xstep;
+	int     max;
+};
+
+struct view view, home;
+
+/* the picture: all rows of the terminal but the last, which has the status */
+int cols, rows;
+int *cells;		/* iteration counts, written by the workers */
+int *shown;		/* palette keys of what the terminal shows, -1 for not known */
+char *screen_buf;
+
+/*
+ * One pass of a job: the points are those of the lattice of steps
+ * block * xstep, block * ystep (mandel-cache.h), from pi0, pj0 to pi1, pj1,
+ * each the color of block x block cells; the tasks are the lattice tiles
+ * from tx0, ty0 that hold them.
+ */
+struct pass {
+	int   block;
+	long  pi0, pj0, pi1, pj1;
+	long  tx0, ty0;
+	int   per_row, nr_tasks;
+};
+
+struct {
+	pthread_mutex_t     lock;
+	pthread_cond_t      work;	/* a job to do, or time to go */
+	pthread_cond_t      idle;	/* a worker has left the job */
+	int                 gen;	/* of the job; a worker that sees it change stops */
+	int                 running, quit;
+	int                 busy;	/* workers on the job */
+	long                next;	/* task counter, the coarse pass first */
+	long                coarse_left, done;
+	int                 nr_tasks;
+
+	/* the view of the job: cell (0, 0) is lattice point (i0, j0) */
+	double              xstep, ystep;
+	long                i0, j0;
+	int                 max;
+	struct mandel_deep  *deep;	/* or the cache, past doubles */
+	struct pass         pass[2];
+	const char          *engine;
+	double              start_ms, ms;	/* ms is -1 until it is all drawn */
+} job;
+
+struct mandel_cache *cache;
+int palette_nr;
+int truecolor;
+
+/* the signal handlers only write a byte here, which wakes poll() up */
+int sigpipe[2];
+volatile sig_atomic_t resized, stopped;
+
+struct termios saved_tio;
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static long floor_div(long a, long b)
+{
+	return a / b - (a % b < 0);
+}
+
+/*****************
+ * The workers   *
+ *****************/
+
+/* the color of lattice point (i, j) of pass p, over its cells on the screen */
+static void fill_block(const struct pass *p, long i, long j, int val)
+{
+	int c0, r0, c, r;
+
+	c0 = i * p->block - job.i0;
+	r0 = j * p->block - job.j0;
+	for (r = r0 > 0 ? r0 : 0; r < r0 + p->block && r < rows - 1; r++)
+		for (c = c0 > 0 ? c0 : 0; c < c0 + p->block && c < cols; c++)
+			__atomic_store_n(&cells[(size_t)r * cols + c], val, __ATOMIC_RELAXED);
+}
+
+/* task t of pass p: one tile, cached, or perturbed only where it shows */
+static void draw_task(const struct pass *p, int t, int gen)
+{
+	int iters[SIDE * SIDE];
+	double dx[SIDE], xstep = p->block * job.xstep, ystep = p->block * job.ystep;
+	long tx = p->tx0 + t % p->per_row, ty = p->ty0 + t / p->per_row;
+	long u0, u1, v0, v1, u, v;
+
+	u0 = (tx * SIDE > p->pi0 ? tx * SIDE : p->pi0) - tx * SIDE;
+	u1 = (tx * SIDE + SIDE - 1 < p->pi1 ? tx * SIDE + SIDE - 1 : p->pi1) - tx * SIDE;
+	v0 = (ty * SIDE > p->pj0 ? ty * SIDE : p->pj0) - ty * SIDE;
+	v1 = (ty * SIDE + SIDE - 1 < p->pj1 ? ty * SIDE + SIDE - 1 : p->pj1) - ty * SIDE;
+
+	if (job.deep == NULL)
+		mandel_cache_tile(cache, xstep, ystep, tx, ty, job.max, iters);
+	else {
+		for (u = u0; u <= u1; u++)
+			dx[u] = (tx * SIDE + u) * xstep;
+		for (v = v0; v <= v1; v++) {
+			if (__atomic_load_n(&job.gen, __ATOMIC_RELAXED) != gen)
+				return;
+			mandel_deep_iterations_at_points(job.deep, dx + u0, -(ty * SIDE + v) * ystep,
+				u1 - u0 + 1, iters + v * SIDE + u0);
+		}
+	}
+	for (v = v0; v <= v1; v++)
+		for (u = u0; u <= u1; u++)
+			fill_block(p, tx * SIDE + u, ty * SIDE + v, iters[v * SIDE + u]);
+}
+
+static void *explore_worker(void *arg)
+{
+	int gen = 0, coarse;
+	long t;
+
+	pthread_mutex_lock(&job.lock);
+	for (;;) {
+		while (!job.quit && (!job.running || job.gen == gen))
+			pthread_cond_wait(&job.work, &job.lock);
+		if (job.quit)
+			break;
+		gen = job.gen;
+		job.busy++;
+		pthread_mutex_unlock(&job.lock);
+
+		while ((t = __atomic_fetch_add(&job.next, 1, __ATOMIC_RELAXED)) < job.nr_tasks &&
+		       __atomic_load_n(&job.gen, __ATOMIC_RELAXED) == gen) {
+			coarse = t < job.pass[0].nr_tasks;
+			/* a coarse point drawn late would blot out the fine ones */
+			while (!coarse && __atomic_load_n(&job.coarse_left, __ATOMIC_ACQUIRE) &&
+			       __atomic_load_n(&job.gen, __ATOMIC_RELAXED) == gen)
+				sched_yield();
+			if (coarse)
+				draw_task(&job.pass[0], t, gen);
+			else
+				draw_task(&job.pass[1], t - job.pass[0].nr_tasks, gen);
+			if (coarse)
+				__atomic_sub_fetch(&job.coarse_left, 1, __ATOMIC_RELEASE);
+			__atomic_add_fetch(&job.done, 1, __ATOMIC_RELEASE);
+		}
+
+		pthread_mutex_lock(&job.lock);
+		job.busy--;
+		pthread_cond_broadcast(&job.idle);
+	}
+	pthread_mutex_unlock(&job.lock);
+	return NULL;
+}
+
+/* stop the job and wait until no worker touches the picture */
+static void job_stop(void)
+{
+	pthread_mutex_lock(&job.lock);
+	job.running = 0;
+	job.gen++;
+	while (job.busy)
+		pthread_cond_wait(&job.idle, &job.lock);
+	pthread_mutex_unlock(&job.lock);
+	if (job.deep) {
+		mandel_deep_destroy(job.deep);
+		job.deep = NULL;
+	}
+}
+
+static void pass_init(struct pass *p, int block)
+{
+	p->block = block;
+	p->pi0 = floor_div(job.i0, block);
+	p->pj0 = floor_div(job.j0, block);
+	p->pi1 = floor_div(job.i0 + cols - 1, block);
+	p->pj1 = floor_div(job.j0 + rows - 2, block);
+	p->tx0 = floor_div(p->pi0, SIDE);
+	p->ty0 = floor_div(p->pj0, SIDE);
+	p->per_row = floor_div(p->pi1, SIDE) - p->tx0 + 1;
+	p->nr_tasks = p->per_row * (floor_div(p->pj1, SIDE) - p->ty0 + 1);
+}
+
+/* draw view, with the workers stopped */
+static void job_start(void)
+{
+	double x = strtod(view.cx, NULL), y = strtod(view.cy, NULL);
+
+	job.xstep = view.xstep;
+	job.ystep = CELL_ASPECT * view.xstep;
+	job.max = view.max;
+	/* past doubles, the lattice is around a reference at the center */
+	if (mandel_deep_needed(x, y, job.xstep)) {
+		job.deep = mandel_deep_create(view.cx, view.cy, job.xstep, job.max);
+		job.engine = "perturbation";
+		x = y = 0;
+	} else
+		job.engine = mandel_precision_for(fabs(x) + job.xstep * cols,
+			fabs(y) + job.ystep * rows, job.xstep, job.max) == MANDEL_FLOAT ?
+			"float" : "double";
+	job.i0 = lround(x / job.xstep) - cols / 2;
+	job.j0 = lround(-y / job.ystep) - (rows - 1) / 2;
+	pass_init(&job.pass[0], COARSE_BLOCK);
+	pass_init(&job.pass[1], 1);
+	job.nr_tasks = job.pass[0].nr_tasks + job.pass[1].nr_tasks;
+	job.next = 0;
+	job.done = 0;
+	job.coarse_left = job.pass[0].nr_tasks;
+	job.start_ms = now_ms();
+	job.ms = -1;
+
+	pthread_mutex_lock(&job.lock);
+	job.gen++;
+	job.running = 1;
+	pthread_cond_broadcast(&job.work);
+	pthread_mutex_unlock(&job.lock);
+}
+
+/*****************
+ * The terminal  *
+ *****************/
+
+static void term_write(const char *s, size_t len)
+{
+	if (insist_write(1, s, len) != len) {
+		perror("mandel-explore: write");
+		exit(1);
+	}
+}
+
+static void term_restore(void)
+{
+	static const char bye[] = "\033[0m\033[?25h\033[?1049l";
+
+	term_write(bye, sizeof(bye) - 1);
+	tcsetattr(0, TCSAFLUSH, &saved_tio);
+}
+
+static void on_signal(int sig)
+{
+	int saved_errno = errno;
+
+	if (sig == SIGWINCH)
+		resized = 1;
+	else
+		stopped = 1;
+	if (write(sigpipe[1], "", 1) < 0)
+		;	/* full: poll() will wake up anyway */
+	errno = saved_errno;
+}
+
+static void term_init(void)
+{
+	static const char hello[] = "\033[?1049h\033[?25l\033[2J";
+	struct termios tio;
+	struct sigaction sa;
+
+	if (!isatty(0) || !isatty(1) || tcgetattr(0, &saved_tio) < 0) {
+		fprintf(stderr, "mandel-explore: needs a terminal\n");
+		exit(1);
+	}
+	/* keys one at a time, unechoed; ^C is a key too, the terminal is put back on q */
+	tio = saved_tio;
+	tio.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+	tio.c_iflag &= ~(IXON | ICRNL);
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	if (tcsetattr(0, TCSAFLUSH, &tio) < 0) {
+		perror("mandel-explore: tcsetattr");
+		exit(1);
+	}
+
+	if (pipe(sigpipe) < 0 || fcntl(sigpipe[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(sigpipe[1], F_SETFL, O_NONBLOCK) < 0) {
+		perror("mandel-explore: pipe");
+		exit(1);
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGWINCH, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	term_write(hello, sizeof(hello) - 1);
+}
+
+/* the size of the terminal, the picture and the buffers to match */
+static void term_size(void)
+{
+	struct winsize ws;
+	size_t i;
+
+	if (ioctl(1, TIOCGWINSZ, &ws) < 0 || ws.ws_col < 1 || ws.ws_row < 2) {
+		ws.ws_col = 80;
+		ws.ws_row = 24;
+	}
+	cols = ws.ws_col;
+	rows = ws.ws_row;
+	free(cells);
+	free(shown);
+	free(screen_buf);
+	cells = calloc((size_t)cols * (rows - 1), sizeof(*cells));
+	shown = malloc((size_t)cols * (rows - 1) * sizeof(*shown));
+	screen_buf = malloc((rows - 1) * MANDEL_DIFF_BYTES(cols) + 4 * cols + 64);
+	if (!cells || !shown || !screen_buf) {
+		fprintf(stderr, "mandel-explore: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < (size_t)cols * (rows - 1); i++)
+		shown[i] = -1;
+	term_write("\033[2J", 4);
+}
+
+/* the cells that changed and the status line, in one write() */
+static void redraw(void)
+{
+	int row_vals[cols], r, c, len;
+	char *p = screen_buf, status[256], what[64];
+	double x = strtod(view.cx, NULL), y = strtod(view.cy, NULL);
+	struct mandel_cache_stats st;
+	long done = __atomic_load_n(&job.done, __ATOMIC_ACQUIRE);
+
+	/*
+	 * Zoomed in, the counts are all past the palette: the colors go round
+	 * it, and only the points that never escape keep the last one.
+	 */
+	for (r = 0; r < rows - 1; r++) {
+		for (c = 0; c < cols; c++) {
+			row_vals[c] = __atomic_load_n(&cells[(size_t)r * cols + c], __ATOMIC_RELAXED);
+			row_vals[c] = row_vals[c] >= job.max ? 255 : row_vals[c] % 255;
+		}
+		p += mandel_render_line_diff(p, row_vals, shown + (size_t)r * cols, cols, r);
+	}
+
+	mandel_cache_get_stats(cache, &st);
+	if (job.ms < 0)
+		snprintf(what, sizeof(what), "drawing %ld%%",
+			job.nr_tasks ? 100 * done / job.nr_tasks : 0);
+	else
+		snprintf(what, sizeof(what), "%.0f ms, cache %.0f%%", job.ms,
+			st.hits + st.misses ? 100.0 * st.hits / (st.hits + st.misses) : 0.0);
+	len = snprintf(status, sizeof(status), "%.12g%+.12gi  w %.3g  max %d  %s  %s  "
+		"| arrows/hjkl pan  +/- zoom  [ ] max  p palette  r reset  q quit",
+		x, y, view.xstep * cols, view.max, job.engine, what);
+	if (len >= (int)sizeof(status))
+		len = sizeof(status) - 1;
+	if (len > cols)
+		len = cols;
+	p += sprintf(p, "\033[%d;1H\033[0m", rows);
+	memcpy(p, status, len);
+	p += len;
+	p += sprintf(p, "\033[K");
+	term_write(screen_buf, p - screen_buf);
+}
+
+/*****************
+ * The keys      *
+ *****************/
+
+static void set_center(char *cx, char *cy)
+{
+	free(view.cx);
+	free(view.cy);
+	view.cx = cx;
+	view.cy = cy;
+}
+
+/* pan by dc columns and dr rows, whole cells so that the lattice stays */
+static void pan(int dc, int dr)
+{
+	double ystep = CELL_ASPECT * view.xstep;
+
+	set_center(mandel_deep_offset(view.cx, dc * view.xstep, view.xstep),
+		mandel_deep_offset(view.cy, -dr * ystep, ystep));
+}
+
+/* 1 if the view changed, 0 if not, -1 to quit */
+static int handle_keys(const char *k, int n)
+{
+	int i, changed = 0, dc = cols / PAN_PARTS, dr = (rows - 1) / PAN_PARTS;
+
+	if (dc < 1)
+		dc = 1;
+	if (dr < 1)
+		dr = 1;
+	for (i = 0; i < n; i++) {
+		/* arrows are ESC [ A to D */
+		if (k[i] == '\033' && i + 2 < n && k[i + 1] == '[') {
+			i += 2;
+			switch (k[i]) {
+			case 'A': pan(0, -dr); changed = 1; break;
+			case 'B': pan(0, dr); changed = 1; break;
+			case 'C': pan(dc, 0); changed = 1; break;
+			case 'D': pan(-dc, 0); changed = 1; break;
+			}
+			continue;
+		}
+		switch (k[i]) {
+		case 'q':
+		case 'Q':
+		case 3:		/* ^C */
+			return -1;
+		case 'k': pan(0, -dr); changed = 1; break;
+		case 'j': pan(0, dr); changed = 1; break;
+		case 'l': pan(dc, 0); changed = 1; break;
+		case 'h': pan(-dc, 0); changed = 1; break;
+		case '+':
+		case '=':
+		case 'i':
+			/* by 2, exact in binary: a view zoomed back to has the same lattice */
+			if (view.xstep > 1e-300) {
+				view.xstep /= 2;
+				changed = 1;
+			}
+			break;
+		case '-':
+		case 'o':
+			if (view.xstep < 1) {
+				view.xstep *= 2;
+				changed = 1;
+			}
+			break;
+		case ']':
+			if (view.max <= (1 << 29)) {
+				view.max *= 2;
+				changed = 1;
+			}
+			break;
+		case '[':
+			if (view.max >= 32) {
+				view.max /= 2;
+				changed = 1;
+			}
+			break;
+		case 'p':
+			if (mandel_palette_name(++palette_nr) == NULL)
+				palette_nr = 0;
+			mandel_set_palette(mandel_palette_name(palette_nr), truecolor);
+			memset(shown, -1, (size_t)cols * (rows - 1) * sizeof(*shown));
+			break;
+		case 'r':
+			set_center(strdup(home.cx), strdup(home.cy));
+			view.xstep = home.xstep;
+			view.max = home.max;
+			changed = 1;
+			break;
+		}
+	}
+	return changed;
+}
+
+static void usage(const char *prog)
+{
+	int k;
+
+	fprintf(stderr, "Usage: %s [-c re,im] [-z width] [-i max_iter] [-j threads]\n"
+		"       [-C megabytes] [-p palette] [-t]\n"
+		"  -c re,im    center of the view, as many digits as it takes\n"
+		"  -z width    width of the view (default 2.8)\n"
+		"  -i max      iteration limit (default 1000)\n"
+		"  -j threads  drawing threads (default: one per CPU)\n"
+		"  -C MB       keep up to MB of tiles to pan and zoom back over (default 64)\n"
+		"  -t          24-bit colors instead of the 256 of xterm\n"
+		"  -p palette  one of:", prog);
+	for (k = 0; mandel_palette_name(k); k++)
+		fprintf(stderr, " %s", mandel_palette_name(k));
+	fprintf(stderr, "\n\nkeys: arrows or hjkl pan, + or i zooms in, - or o out, ] and [\n"
+		"double and halve the iteration limit, p the next palette, r back, q quits\n\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, nthreads, i, ret, drawing, all;
+	double width = 2.8, cache_mb = 64;
+	char *center_x = "-0.4", *center_y = "0", *end, keys[64];
+	const char *palette = "classic";
+	pthread_t *workers;
+	struct pollfd fds[2];
+	ssize_t len;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	home.max = 1000;
+	while ((opt = getopt(argc, argv, "c:z:i:j:C:p:t")) != -1) {
+		switch (opt) {
+		case 'c':
+			center_x = optarg;
+			center_y = strchr(optarg, ',');
+			if (center_y == NULL)
+				usage(argv[0]);
+			*center_y++ = '\0';
+			break;
+		case 'z':
+			width = strtod(optarg, &end);
+			if (*end || !(width > 0))
+				usage(argv[0]);
+			break;
+		case 'i':
+			home.max = atoi(optarg);
+			if (home.max < 1)
+				usage(argv[0]);
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'C':
+			cache_mb = strtod(optarg, &end);
+			if (*end || !(cache_mb > 0))
+				usage(argv[0]);
+			break;
+		case 'p':
+			palette = optarg;
+			break;
+		case 't':
+			truecolor = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || nthreads < 1 || mandel_set_palette(palette, truecolor) < 0)
+		usage(argv[0]);
+	for (palette_nr = 0; strcmp(mandel_palette_name(palette_nr), palette); palette_nr++)
+		;
+	/* checks the digits, exits on bad ones */
+	free(mandel_deep_offset(center_x, 0, 1));
+	free(mandel_deep_offset(center_y, 0, 1));
+
+	cache = mandel_cache_create(cache_mb * 1024 * 1024);
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.work, NULL);
+	pthread_cond_init(&job.idle, NULL);
+	workers = malloc(nthreads * sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_create(&workers[i], NULL, explore_worker, NULL);
+		if (ret) {
+			perror_pthread(ret, "pthread_create");
+			exit(1);
+		}
+	}
+
+	term_init();
+	term_size();
+	home.cx = center_x;
+	home.cy = center_y;
+	home.xstep = width / cols;
+	view = home;
+	view.cx = strdup(home.cx);
+	view.cy = strdup(home.cy);
+	job_start();
+
+	fds[0].fd = 0;
+	fds[0].events = POLLIN;
+	fds[1].fd = sigpipe[0];
+	fds[1].events = POLLIN;
+	for (drawing = 1; !stopped; ) {
+		ret = poll(fds, 2, drawing ? REFRESH_MS : -1);
+		if (ret < 0 && errno != EINTR) {
+			perror("mandel-explore: poll");
+			break;
+		}
+		if (ret > 0 && (fds[1].revents & POLLIN))
+			while (read(sigpipe[0], keys, sizeof(keys)) > 0)
+				;
+		if (stopped)
+			break;
+		if (resized) {
+			resized = 0;
+			job_stop();
+			term_size();
+			job_start();
+		}
+		if (ret > 0 && (fds[0].revents & POLLIN)) {
+			len = read(0, keys, sizeof(keys));
+			if (len <= 0)
+				break;
+			ret = handle_keys(keys, len);
+			if (ret < 0)
+				break;
+			if (ret > 0) {
+				job_stop();
+				job_start();
+			}
+		}
+		all = __atomic_load_n(&job.done, __ATOMIC_ACQUIRE) == job.nr_tasks;
+		if (all && job.ms < 0)
+			job.ms = now_ms() - job.start_ms;
+		redraw();
+		drawing = !all;
+	}
+
+	job_stop();
+	pthread_mutex_lock(&job.lock);
+	job.quit = 1;
+	pthread_cond_broadcast(&job.work);
+	pthread_mutex_unlock(&job.lock);
+	for (i = 0; i < nthreads; i++) {
+		ret = pthread_join(workers[i], NULL);
+		if (ret)
+			perror_pthread(ret, "pthread_join");
+	}
+	term_restore();
+
+	mandel_cache_destroy(cache);
+	free(workers);
+	free(view.cx);
+	free(view.cy);
+	free(cells);
+	free(shown);
+	free(screen_buf);
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * mandel-image.c
+ *
+ * Image files of the Mandelbrot Set.
+ *
+ * PPM and PFM files are uncompressed, so every pixel has a fixed place in
+ * the file: the file is created at its final size and mapped shared, and a
+ * thread writes its pixels straight to where they belong, with no lock and
+ * no copy. PNG rows are compressed as a whole, so they are collected in an
+ * anonymous mapping the same way and deflated when the image is closed.
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "mandel-lib.h"
+#include "mandel-image.h"
+
+#define HEADER_SIZE 64
+
+int mandel_image_format_of(const char *path)
+{
+	const char *ext = strrchr(path, '.');
+
+	if (ext == NULL)
+		return -1;
+	if (!strcmp(ext, ".ppm"))
+		return MANDEL_PPM;
+	if (!strcmp(ext, ".pfm"))
+		return MANDEL_PFM;
+#ifdef HAVE_ZLIB
+	if (!strcmp(ext, ".png"))
+		return MANDEL_PNG;
+#endif
+	return -1;
+}
+
+struct mandel_image *mandel_image_create(const char *path, int width, int height, int format)
+{
+	struct mandel_image *img;
+	char header[HEADER_SIZE];
+	int len = 0, ret;
+
+	img = calloc(1, sizeof(*img));
+	if (img == NULL) {
+		fprintf(stderr, "mandel_image_create: out of memory\n");
+		exit(1);
+	}
+	img->format = format;
+	img->width = width;
+	img->height = height;
+	img->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (img->fd < 0) {
+		perror(path);
+		exit(1);
+	}
+
+	switch (format) {
+	case MANDEL_PPM:
+		len = snprintf(header, HEADER_SIZE, "P6\n%d %d\n255\n", width, height);
+		img->stride = (size_t)width * 3;
+		break;
+	case MANDEL_PFM:
+		/* a negative scale means little endian floats */
+		len = snprintf(header, HEADER_SIZE, "Pf\n%d %d\n-1.0\n", width, height);
+		img->stride = (size_t)width * sizeof(float);
+		break;
+	case MANDEL_PNG:
+		/* a filter type byte, 0, in front of every row */
+		img->stride = 1 + (size_t)width * 3;
+		img->map_len = img->stride * height;
+		img->map = mmap(NULL, img->map_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (img->map == MAP_FAILED) {
+			perror("mandel_image_create: mmap");
+			exit(1);
+		}
+		img->data = 1;
+		return img;
+	}
+
+	/* all the space at once, so that the mapping cannot run out of disk */
+	img->map_len = len + img->stride * height;
+	ret = posix_fallocate(img->fd, 0, img->map_len);
+	if (ret) {
+		errno = ret;
+		perror(path);
+		exit(1);
+	}
+	img->map = mmap(NULL, img->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, img->fd, 0);
+	if (img->map == MAP_FAILED) {
+		perror("mandel_image_create: mmap");
+		exit(1);
+	}
+	memcpy(img->map, header, len);
+	img->data = len;
+	return img;
+}
+
+void mandel_image_put(struct mandel_image *img, int y, int x0, int n, const int *iters)
+{
+	unsigned char *p;
+	const unsigned char *rgb;
+	float f;
+	int i;
+
+	if (img->format == MANDEL_PFM) {
+		/* PFM rows go from the bottom up */
+		p = img->map + img->data + img->stride * (img->height - 1 - y) + x0 * sizeof(float);
+		for (i = 0; i < n; i++, p += sizeof(float)) {
+			f = iters[i];
+			memcpy(p, &f, sizeof(float));
+		}
+		return;
+	}
+
+	p = img->map + img->data + img->stride * y + x0 * 3;
+	for (i = 0; i < n; i++, p += 3) {
+		rgb = mandel_palette_rgb(iters[i]);
+		p[0] = rgb[0];
+		p[1] = rgb[1];
+		p[2] = rgb[2];
+	}
+}
+
+void mandel_image_stream(int fd, int width, int height, const int *iters)
+{
+	size_t stride = (size_t)width * 3, len, i;
+	unsigned char *buf, *p;
+	const unsigned char *rgb;
+
+	buf = malloc(HEADER_SIZE + stride * height);
+	if (buf == NULL) {
+		fprintf(stderr, "mandel_image_stream: out of memory\n");
+		exit(1);
+	}
+	len = snprintf((char *)buf, HEADER_SIZE, "P6\n%d %d\n255\n", width, height);
+	for (p = buf + len, i = 0; i < (size_t)width * height; i++, p += 3) {
+		rgb = mandel_palette_rgb(iters[i]);
+		p[0] = rgb[0];
+		p[1] = rgb[1];
+		p[2] = rgb[2];
+	}
+	len += stride * height;
+	if (insist_write(fd, (char *)buf, len) != len) {
+		perror("mandel_image_stream: write");
+		exit(1);
+	}
+	free(buf);
+}
+
+#ifdef HAVE_ZLIB
+
+#define PNG_IDAT_SIZE (1 << 20)
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* length, type, data, and the CRC of type and data */
+static void png_chunk(int fd, const char *type, const unsigned char *data, uint32_t len)
+{
+	unsigned char head[8], crc[4];
+	uLong c;
+
+	put_be32(head, len);
+	memcpy(head + 4, type, 4);
+	c = crc32(0, head + 4, 4);
+	if (len)
+		c = crc32(c, data, len);	/* a NULL buffer would restart it */
+	put_be32(crc, c);
+	if (insist_write(fd, (char *)head, 8) != 8 ||
+	    insist_write(fd, (const char *)data, len) != len ||
+	    insist_write(fd, (char *)crc, 4) != 4) {
+		perror("mandel_image_close: write");
+		exit(1);
+	}
+}
+
+static void png_write(struct mandel_image *img)
+{
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	unsigned char ihdr[13], *out;
+	z_stream z;
+	int ret;
+
+	if (insist_write(img->fd, (const char *)signature, 8) != 8) {
+		perror("mandel_image_close: write");
+		exit(1);
+	}
+	put_be32(ihdr, img->width);
+	put_be32(ihdr + 4, img->height);
+	ihdr[8] = 8;		/* bits per channel */
+	ihdr[9] = 2;		/* RGB */
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;	/* deflate, filters per row, no interlace */
+	png_chunk(img->fd, "IHDR", ihdr, sizeof(ihdr));
+
+	out = malloc(PNG_IDAT_SIZE);
+	if (out == NULL) {
+		fprintf(stderr, "mandel_image_close: out of memory\n");
+		exit(1);
+	}
+	memset(&z, 0, sizeof(z));
+	/* big images: speed matters more than the last few percent */
+	if (deflateInit(&z, Z_BEST_SPEED) != Z_OK) {
+		fprintf(stderr, "mandel_image_close: deflateInit failed\n");
+		exit(1);
+	}
+	z.next_in = img->map;
+	z.avail_in = 0;
+	do {
+		/* avail_in is only 32 bits, feed the rows a piece at a time */
+		if (z.avail_in == 0 && z.next_in < img->map + img->map_len) {
+			size_t left = img->map + img->map_len - z.next_in;
+			z.avail_in = left > (1u << 30) ? (1u << 30) : left;
+		}
+		z.next_out = out;
+		z.avail_out = PNG_IDAT_SIZE;
+		ret = deflate(&z, z.next_in + z.avail_in == img->map + img->map_len ?
+			Z_FINISH : Z_NO_FLUSH);
+		if (ret == Z_STREAM_ERROR) {
+			fprintf(stderr, "mandel_image_close: deflate failed\n");
+			exit(1);
+		}
+		if (PNG_IDAT_SIZE - z.avail_out)
+			png_chunk(img->fd, "IDAT", out, PNG_IDAT_SIZE - z.avail_out);
+	} while (ret != Z_STREAM_END);
+	deflateEnd(&z);
+	free(out);
+	png_chunk(img->fd, "IEND", NULL, 0);
+}
+
+#endif /* HAVE_ZLIB */
+
+void mandel_image_close(struct mandel_image *img)
+{
+#ifdef HAVE_ZLIB
+	if (img->format == MANDEL_PNG)
+		png_write(img);
+#endif
+	if (munmap(img->map, img->map_len) < 0)
+		perror("mandel_image_close: munmap");
+	if (close(img->fd) < 0) {
+		perror("mandel_image_close: close");
+		exit(1);
+	}
+	free(img);
+}
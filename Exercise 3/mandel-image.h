@@ -0,0 +1,50 @@
+/*
+ * mandel-image.h
+ *
+ * Image files of the Mandelbrot Set, for renders too big for a terminal.
+ *
+ */
+
+#ifndef MANDEL_IMAGE_H__
+#define MANDEL_IMAGE_H__
+
+#include <stddef.h>
+
+enum mandel_image_format {
+	MANDEL_PPM,	/* binary RGB, colored with the palette */
+	MANDEL_PFM,	/* one float per pixel: the iteration count itself */
+	MANDEL_PNG,	/* RGB like PPM, compressed; only with HAVE_ZLIB */
+};
+
+struct mandel_image {
+	int            format;
+	int            width, height;
+	int            fd;
+	unsigned char  *map;	/* PPM, PFM: the whole file; PNG: the raw rows */
+	size_t         map_len;
+	size_t         data;	/* offset of the first pixel in map */
+	size_t         stride;	/* bytes from one row to the next */
+};
+
+/* The format a file name asks for, by its extension, -1 if none fits. */
+int mandel_image_format_of(const char *path);
+
+/*
+ * Create path at its final size and map it, exits on failure.
+ * Any thread can then fill in any part of the picture, in any order.
+ */
+struct mandel_image *mandel_image_create(const char *path, int width, int height, int format);
+
+/* Pixels x0 to x0 + n - 1 of row y, from their iteration counts. */
+void mandel_image_put(struct mandel_image *img, int y, int x0, int n, const int *iters);
+
+/*
+ * The whole picture as a binary PPM to fd, in one go: a frame of a stream
+ * of them (ffmpeg -f image2pipe), where nothing can be mapped.
+ */
+void mandel_image_stream(int fd, int width, int height, const int *iters);
+
+/* Unmap, compress for PNG, and close. */
+void mandel_image_close(struct mandel_image *img);
+
+#endif /* MANDEL_IMAGE_H__ */
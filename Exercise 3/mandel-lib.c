@@ -6,6 +6,9 @@
  *
  */
 
+/* a*b+c must stay two roundings, to match the kernels in mandel-simd.c */
+#pragma GCC optimize ("fp-contract=off")
+
 #include <stdio.h>
 #include <unistd.h>
 #include <assert.h>
@@ -91,24 +94,26 @@ static void maketable()
 		colortable[c][1] = rgb[1];
 		colortable[c][2] = rgb[2];
 	}
+	initialized = 1;
 }
 
 // selects the nearest xterm color for a 3xBYTE rgb value
 static unsigned char rgb2xterm(unsigned char* rgb)
 {
 	unsigned char c, best_match=0;
-	double d, smallest_distance;
+	int d, dr, dg, db, smallest_distance;
 
 	if(!initialized)
 		maketable();
 
-	smallest_distance = 10000000000.0;
+	smallest_distance = 3 * 255 * 255 + 1;
 	
 	for(c=0;c<=253;c++)
 	{
-		d = pow(colortable[c][0]-rgb[0],2.0) + 
-			pow(colortable[c][1]-rgb[1],2.0) + 
-			pow(colortable[c][2]-rgb[2],2.0);
+		dr = colortable[c][0]-rgb[0];
+		dg = colortable[c][1]-rgb[1];
+		db = colortable[c][2]-rgb[2];
+		d = dr*dr + dg*dg + db*db;
 		if(d<smallest_distance)
 		{
 			smallest_distance = d;
@@ -386,12 +391,188 @@ static struct { double red; double green; double blue; } mandel256[] = {
 	{0.000,0.000,0.000}
 };
 
+/*******************************************
+ *                                         *
+ * Palettes: every color value 0-255 is    *
+ * mapped once, when a palette is chosen.  *
+ *                                         *
+ *******************************************/
+
+/* the palettes other than mandel256[], as functions of the color value */
+static void palette_classic(int i, double *rgb)
+{
+	rgb[0] = mandel256[i].red;
+	rgb[1] = mandel256[i].green;
+	rgb[2] = mandel256[i].blue;
+}
+
+static void palette_fire(int i, double *rgb)
+{
+	double t = i / 255.0;
+
+	rgb[0] = t < 0.4 ? t / 0.4 : 1.0;
+	rgb[1] = t < 0.4 ? 0.0 : t < 0.8 ? (t - 0.4) / 0.4 : 1.0;
+	rgb[2] = t < 0.8 ? 0.0 : (t - 0.8) / 0.2;
+}
+
+static void palette_ocean(int i, double *rgb)
+{
+	double t = i / 255.0;
+
+	rgb[0] = t * t;
+	rgb[1] = t;
+	rgb[2] = 0.3 + 0.7 * sqrt(t);
+}
+
+static void palette_gray(int i, double *rgb)
+{
+	rgb[0] = rgb[1] = rgb[2] = i / 255.0;
+}
+
+/* hue going round every 32 values, so that neighbouring bands differ */
+static void palette_rainbow(int i, double *rgb)
+{
+	double h = (i % 32) / 32.0 * 6.0, f = h - floor(h);
+	static const int ramp[6][3] = {	/* 0: 0, 1: 1, 2: rising, 3: falling */
+		{1, 2, 0}, {3, 1, 0}, {0, 1, 2}, {0, 3, 1}, {2, 0, 1}, {1, 0, 3},
+	};
+	int k;
+
+	for (k = 0; k < 3; k++)
+		switch (ramp[(int)h][k]) {
+		case 0: rgb[k] = 0.0; break;
+		case 1: rgb[k] = 1.0; break;
+		case 2: rgb[k] = f; break;
+		case 3: rgb[k] = 1.0 - f; break;
+		}
+	if (i == 255)
+		rgb[0] = rgb[1] = rgb[2] = 0.0;	/* the set itself */
+}
+
+static const struct {
+	const char  *name;
+	void        (*color)(int i, double *rgb);
+} palettes[] = {
+	{ "classic", palette_classic },
+	{ "fire",    palette_fire },
+	{ "ocean",   palette_ocean },
+	{ "gray",    palette_gray },
+	{ "rainbow", palette_rainbow },
+};
+
+#define NR_PALETTES ((int)(sizeof(palettes) / sizeof(palettes[0])))
+
+/*
+ * The current palette: the nearest xterm color of every value, and the escape
+ * that sets its color. key[] tells which values set the same color, so that
+ * escapes can be skipped between them.
+ */
+static struct {
+	unsigned char  rgb[256][3];
+	unsigned char  xterm[256];
+	unsigned char  len[256];
+	char           escape[256][MANDEL_ESCAPE_BYTES];
+	int            key[256];
+} pal;
+
+/*
+ * Choose a palette by name, for 256-color xterms or, with truecolor,
+ * for terminals that take 24-bit colors. Returns -1 for an unknown name.
+ * Not to be called while lines are being rendered.
+ */
+int mandel_set_palette(const char *name, int truecolor)
+{
+	unsigned char rgb[3];
+	double c[3];
+	int i, k, p;
+
+	for (p = 0; p < NR_PALETTES && strcmp(palettes[p].name, name); p++)
+		;
+	if (p == NR_PALETTES)
+		return -1;
+
+	for (i = 0; i < 256; i++) {
+		palettes[p].color(i, c);
+		for (k = 0; k < 3; k++)
+			pal.rgb[i][k] = rgb[k] = 255.0 * c[k];
+		pal.xterm[i] = rgb2xterm(rgb);
+		if (truecolor) {
+			pal.len[i] = snprintf(pal.escape[i], MANDEL_ESCAPE_BYTES,
+				"\033[38;2;%d;%d;%dm", rgb[0], rgb[1], rgb[2]);
+			pal.key[i] = rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+		} else {
+			pal.len[i] = snprintf(pal.escape[i], MANDEL_ESCAPE_BYTES,
+				"\033[38;5;%dm", pal.xterm[i]);
+			pal.key[i] = pal.xterm[i];
+		}
+	}
+	return 0;
+}
+
+/* The palette's own 24-bit color for a color value, e.g. for images. */
+const unsigned char *mandel_palette_rgb(int color_val)
+{
+	return pal.rgb[color_val > 255 ? 255 : color_val];
+}
+
+/* Name of the k-th palette, NULL past the end. */
+const char *mandel_palette_name(int k)
+{
+	return k >= 0 && k < NR_PALETTES ? palettes[k].name : NULL;
+}
+
+/* the classic palette for 256 colors, ready before main() */
+__attribute__((constructor))
+static void default_palette(void)
+{
+	mandel_set_palette("classic", 0);
+}
+
+
 /*******************************************
  *                                         *
  * Functions to compute the Mandelbrot set *
  *                                         *
  *******************************************/
 
+/*
+ * Points inside the set never escape, so they cost the full max iterations.
+ * Two shortcuts catch most of them early:
+ *
+ * - the main cardioid and the period-2 bulb, which cover most of the set's
+ *   area, can be tested for directly;
+ * - elsewhere inside, the orbit settles into a cycle, and once z repeats
+ *   exactly it will repeat forever. z is compared with a saved value that is
+ *   refreshed at iterations 1, 2, 4, 8, ... (Brent), which finds a cycle of
+ *   any length without storing the orbit.
+ *
+ * The repeat is exact equality, so the cycle test never changes a count.
+ * The two area tests are exact too, except for points within rounding
+ * of the boundary.
+ */
+static int interior_checks = 1;
+
+void mandel_set_interior_checks(int on)
+{
+	interior_checks = on;
+}
+
+int mandel_interior_checks(void)
+{
+	return interior_checks;
+}
+
+/* Is (x, y) inside the main cardioid or the period-2 bulb? */
+int mandel_in_main_bulbs(double x, double y)
+{
+	double xq = x - 0.25;
+	double q = xq * xq + y * y;
+
+	if (q * (q + xq) <= 0.25 * y * y)
+		return 1;
+	return (x + 1) * (x + 1) + y * y <= 0.0625;
+}
+
 /*
  * This function takes a (x,y) point on the complex plane
  * and uses the escape time algorithm to return a color value
@@ -401,7 +582,12 @@ int mandel_iterations_at_point(double x, double y, int max)
 {
 	double x0 = x;
 	double y0 = y;
+	double xs = x, ys = y;	/* saved point of the orbit, for the cycle test */
 	int iter = 0;
+	long save_at = 1;
+
+	if (interior_checks && mandel_in_main_bulbs(x0, y0))
+		return max;
 
 	while ( (x * x + y * y <= 4) && iter < max) {
 		double xt = x * x - y * y + x0;
@@ -411,6 +597,16 @@ int mandel_iterations_at_point(double x, double y, int max)
 		y = yt;
 
 		++iter;
+
+		if (!interior_checks)
+			continue;
+		if (x == xs && y == ys)
+			return max;	/* a cycle, it would never escape */
+		if (iter == save_at) {
+			xs = x;
+			ys = y;
+			save_at *= 2;
+		}
 	}
 
 	return iter;
@@ -418,24 +614,16 @@ int mandel_iterations_at_point(double x, double y, int max)
 
 /*
  * This function takes a color value as returned
- * by mandelbrot_iterations() and uses the 256-color
- * palette defined above to return an approximation for 256-color
+ * by mandelbrot_iterations() and uses the current
+ * palette to return an approximation for 256-color
  * xterms.
  */
 unsigned char xterm_color(int color_val)
 {
-	unsigned char rgb[3];
-
 	if (color_val > 255)
 		color_val = 255;
 
-	rgb[0] = 255.0 * mandel256[color_val].red;
-	rgb[1] = 255.0 * mandel256[color_val].green;
-	rgb[2] = 255.0 * mandel256[color_val].blue;
-	color_val = rgb2xterm(rgb);
-	
-	assert(0 <= color_val && color_val <= 255);
-	return color_val;
+	return pal.xterm[color_val];
 }
 
 /*
@@ -458,6 +646,64 @@ ssize_t insist_write(int fd, const char *buf, size_t count)
 	return orig_count;
 }
 
+/*
+ * Render a line of n cells, each an '@' in the palette's color for the color
+ * value color_val[i], followed by a newline, into buf, which must hold
+ * MANDEL_LINE_BYTES(n). With coalesce, the color is only set again when it
+ * changes, otherwise before every cell, as set_xterm_color() per cell would.
+ * Returns the number of bytes used.
+ */
+size_t mandel_render_line(char *buf, const int *color_val, int n, int coalesce)
+{
+	char *p = buf;
+	int i, c, last = -1;	/* every line starts with a color of its own */
+
+	for (i = 0; i < n; i++) {
+		c = color_val[i] > 255 ? 255 : color_val[i];
+		if (pal.key[c] != last || !coalesce) {
+			memcpy(p, pal.escape[c], MANDEL_ESCAPE_BYTES);
+			p += pal.len[c];
+			last = pal.key[c];
+		}
+		*p++ = '@';
+	}
+	*p++ = '\n';
+
+	return p - buf;
+}
+
+/*
+ * Redraw screen row row (0 at the top) of n cells, where shown[] has the
+ * colors on the screen now (palette keys, -1 for not known): only the cells
+ * whose color is not that of color_val[] any more, every run of them after a
+ * cursor move. shown[] is brought up to date. buf must hold
+ * MANDEL_DIFF_BYTES(n). Returns the number of bytes used, 0 if the row
+ * is as it should be.
+ */
+size_t mandel_render_line_diff(char *buf, const int *color_val, int *shown, int n, int row)
+{
+	char *p = buf;
+	int i, c, last = -1, at = -1;	/* the column the cursor is at, -1 if not known */
+
+	for (i = 0; i < n; i++) {
+		c = color_val[i] > 255 ? 255 : color_val[i];
+		if (shown[i] == pal.key[c])
+			continue;
+		if (at != i)
+			p += snprintf(p, MANDEL_MOVE_BYTES, "\033[%d;%dH", row + 1, i + 1);
+		if (pal.key[c] != last) {
+			memcpy(p, pal.escape[c], MANDEL_ESCAPE_BYTES);
+			p += pal.len[c];
+			last = pal.key[c];
+		}
+		*p++ = '@';
+		shown[i] = pal.key[c];
+		at = i + 1;
+	}
+
+	return p - buf;
+}
+
 /*
  * This function outputs the proper control sequence
  * to change the current color of a 256-color xterm.
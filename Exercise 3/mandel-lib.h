@@ -11,9 +11,41 @@
 
 /* Function prototypes */
 int mandel_iterations_at_point(double x, double y, int max);
+int mandel_in_main_bulbs(double x, double y);
+void mandel_set_interior_checks(int on);
+int mandel_interior_checks(void);
+
+/* mandel-simd.c: the same for a run of points, vectorized */
+void mandel_iterations_at_points(const double *x, double y, int n, int max, int *iters);
+void mandel_iterations_at_xy(const double *x, const double *y, int n, int max, int *iters);
+const char *mandel_kernel_name(void);
+int mandel_set_kernel(const char *name);
+const char *mandel_kernel_at(int k);
+
+/* the kernels above in float or in double */
+#define MANDEL_FLOAT  0
+#define MANDEL_DOUBLE 1
+int mandel_precision_for(double x, double y, double step, int max);
+void mandel_set_precision(int p);
+int mandel_precision(void);
+void mandel_iterations_at_points_prec(int p, const double *x, double y, int n, int max, int *iters);
+
 unsigned char xterm_color(int color_val);
 ssize_t insist_write(int fd, const char *buf, size_t count);
 void set_xterm_color(int fd, unsigned char color);
+
+/* longest escape, "\033[38;2;255;255;255m", padded; a cell is one and the '@' */
+#define MANDEL_ESCAPE_BYTES 20
+#define MANDEL_CELL_BYTES (MANDEL_ESCAPE_BYTES + 1)
+#define MANDEL_LINE_BYTES(n) ((size_t)(n) * MANDEL_CELL_BYTES + 1)
+int mandel_set_palette(const char *name, int truecolor);
+const char *mandel_palette_name(int k);
+const unsigned char *mandel_palette_rgb(int color_val);
+size_t mandel_render_line(char *buf, const int *color_val, int n, int coalesce);
+/* longest cursor move, "\033[65535;65535H", padded; a changed cell may need one */
+#define MANDEL_MOVE_BYTES 16
+#define MANDEL_DIFF_BYTES(n) ((size_t)(n) * (MANDEL_CELL_BYTES + MANDEL_MOVE_BYTES))
+size_t mandel_render_line_diff(char *buf, const int *color_val, int *shown, int n, int row);
 void reset_xterm_color(int fd);
 
 #endif /* MANDEL_LIB_H__ */
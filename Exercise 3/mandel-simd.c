@@ -0,0 +1,566 @@
+/*
+ * mandel-simd.c
+ *
+ * Vectorized escape time kernels: 2 (SSE2), 4 (AVX2) or 8 (AVX-512) points
+ * of a line, or any points at all, are iterated in lockstep, each lane
+ * leaving the count when it escapes. The widest one the CPU has is picked
+ * at startup.
+ *
+ * Every lane does exactly the operations of mandel_iterations_at_point(), in
+ * the same order and without fused multiply-adds, so the iteration counts are
+ * the same as the scalar ones, bit for bit.
+ *
+ */
+
+/* a*b+c must stay two roundings, here and in mandel-lib.c */
+#pragma GCC optimize ("fp-contract=off")
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include "mandel-lib.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+/*
+ * Float is used while a step between points spans at least this many float
+ * ulps; closer than that, rounding moves orbits across pixels.
+ */
+#define PRECISION_ULPS_PER_STEP 64
+
+/* point i is (x[i * dx], y[i * dy]): dx, dy are 1 to walk an array, 0 to stay */
+typedef void mandel_kernel_fn(const double *x, int dx, const double *y, int dy,
+	int n, int max, int *iters);
+
+static void points_scalar(const double *x, int dx, const double *y, int dy,
+	int n, int max, int *iters)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		iters[i] = mandel_iterations_at_point(x[i * dx], y[i * dy], max);
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * All three follow the same scheme. active holds the lanes that have not
+ * escaped yet; a lane's count grows while it is active, and once a lane
+ * drops out it never comes back, even if its z turns to inf or NaN later.
+ *
+ * The interior checks of mandel_iterations_at_point() are done per lane too:
+ * points in the main bulbs start out inactive with a count of max, and a lane
+ * whose z repeats the saved one leaves with max.
+ *
+ * The lanes past the last point repeat it: a vector takes as long as its
+ * slowest lane, so a copy costs nothing, where a narrower kernel for the
+ * rest would take longer over an expensive point.
+ */
+
+/*
+ * the points of lanes from i on in lx, ly, and per lane starting count
+ * and mask; returns the mask as bits too
+ */
+static unsigned start_lanes(const double *x, int dx, const double *y, int dy,
+	int i, int n, int lanes, int max, int checks,
+	double *lx, double *ly, double *cnt, long long *on)
+{
+	unsigned left = 0;
+	int l, k;
+
+	for (l = 0; l < lanes; l++) {
+		k = i + l < n ? i + l : n - 1;
+		lx[l] = x[k * dx];
+		ly[l] = y[k * dy];
+		if (checks && mandel_in_main_bulbs(lx[l], ly[l])) {
+			cnt[l] = max;
+			on[l] = 0;
+		} else {
+			cnt[l] = 0;
+			on[l] = -1;
+			left |= 1u << l;
+		}
+	}
+	return left;
+}
+
+__attribute__((target("sse2")))
+static void points_sse2(const double *x, int dx, const double *y, int dy,
+	int n, int max, int *iters)
+{
+	const __m128d four = _mm_set1_pd(4.0), one = _mm_set1_pd(1.0);
+	const __m128d maxv = _mm_set1_pd(max);
+	__m128d x0, y0, zx, zy, xx, yy, active, cnt, xt, sx, sy, cyc;
+	double lx[2], ly[2], c[2];
+	long long on[2];
+	long save_at;
+	int i, k, l, checks = mandel_interior_checks();
+
+	for (i = 0; i < n; i += 2) {
+		start_lanes(x, dx, y, dy, i, n, 2, max, checks, lx, ly, c, on);
+		x0 = zx = sx = _mm_loadu_pd(lx);
+		y0 = zy = sy = _mm_loadu_pd(ly);
+		cnt = _mm_loadu_pd(c);
+		active = _mm_castsi128_pd(_mm_loadu_si128((__m128i *)on));
+		for (k = 0, save_at = 1; k < max; k++) {
+			xx = _mm_mul_pd(zx, zx);
+			yy = _mm_mul_pd(zy, zy);
+			active = _mm_and_pd(active, _mm_cmple_pd(_mm_add_pd(xx, yy), four));
+			if (!_mm_movemask_pd(active))
+				break;
+			cnt = _mm_add_pd(cnt, _mm_and_pd(active, one));
+			xt = _mm_add_pd(_mm_sub_pd(xx, yy), x0);
+			zy = _mm_add_pd(_mm_mul_pd(_mm_add_pd(zx, zx), zy), y0);
+			zx = xt;
+			if (!checks)
+				continue;
+			cyc = _mm_and_pd(active, _mm_and_pd(_mm_cmpeq_pd(zx, sx), _mm_cmpeq_pd(zy, sy)));
+			if (_mm_movemask_pd(cyc)) {
+				cnt = _mm_or_pd(_mm_andnot_pd(cyc, cnt), _mm_and_pd(cyc, maxv));
+				active = _mm_andnot_pd(cyc, active);
+			}
+			if (k + 1 == save_at) {
+				sx = zx;
+				sy = zy;
+				save_at *= 2;
+			}
+		}
+		_mm_storeu_pd(c, cnt);
+		for (l = 0; l < 2 && i + l < n; l++)
+			iters[i + l] = c[l];
+	}
+}
+
+__attribute__((target("avx2")))
+static void points_avx2(const double *x, int dx, const double *y, int dy,
+	int n, int max, int *iters)
+{
+	const __m256d four = _mm256_set1_pd(4.0), one = _mm256_set1_pd(1.0);
+	const __m256d maxv = _mm256_set1_pd(max);
+	__m256d x0, y0, zx, zy, xx, yy, active, cnt, xt, sx, sy, cyc;
+	double lx[4], ly[4], c[4];
+	long long on[4];
+	long save_at;
+	int i, k, l, checks = mandel_interior_checks();
+
+	for (i = 0; i < n; i += 4) {
+		start_lanes(x, dx, y, dy, i, n, 4, max, checks, lx, ly, c, on);
+		x0 = zx = sx = _mm256_loadu_pd(lx);
+		y0 = zy = sy = _mm256_loadu_pd(ly);
+		cnt = _mm256_loadu_pd(c);
+		active = _mm256_castsi256_pd(_mm256_loadu_si256((__m256i *)on));
+		for (k = 0, save_at = 1; k < max; k++) {
+			xx = _mm256_mul_pd(zx, zx);
+			yy = _mm256_mul_pd(zy, zy);
+			active = _mm256_and_pd(active,
+				_mm256_cmp_pd(_mm256_add_pd(xx, yy), four, _CMP_LE_OQ));
+			if (!_mm256_movemask_pd(active))
+				break;
+			cnt = _mm256_add_pd(cnt, _mm256_and_pd(active, one));
+			xt = _mm256_add_pd(_mm256_sub_pd(xx, yy), x0);
+			zy = _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(zx, zx), zy), y0);
+			zx = xt;
+			if (!checks)
+				continue;
+			cyc = _mm256_and_pd(active, _mm256_and_pd(_mm256_cmp_pd(zx, sx, _CMP_EQ_OQ),
+				_mm256_cmp_pd(zy, sy, _CMP_EQ_OQ)));
+			if (_mm256_movemask_pd(cyc)) {
+				cnt = _mm256_blendv_pd(cnt, maxv, cyc);
+				active = _mm256_andnot_pd(cyc, active);
+			}
+			if (k + 1 == save_at) {
+				sx = zx;
+				sy = zy;
+				save_at *= 2;
+			}
+		}
+		_mm256_storeu_pd(c, cnt);
+		for (l = 0; l < 4 && i + l < n; l++)
+			iters[i + l] = c[l];
+	}
+}
+
+__attribute__((target("avx512f")))
+static void points_avx512(const double *x, int dx, const double *y, int dy,
+	int n, int max, int *iters)
+{
+	const __m512d four = _mm512_set1_pd(4.0), one = _mm512_set1_pd(1.0);
+	const __m512d maxv = _mm512_set1_pd(max);
+	__m512d x0, y0, zx, zy, xx, yy, cnt, xt, sx, sy;
+	__mmask8 active, cyc;
+	double lx[8], ly[8], c[8];
+	long long on[8];
+	long save_at;
+	int i, k, l, checks = mandel_interior_checks();
+
+	for (i = 0; i < n; i += 8) {
+		active = start_lanes(x, dx, y, dy, i, n, 8, max, checks, lx, ly, c, on);
+		x0 = zx = sx = _mm512_loadu_pd(lx);
+		y0 = zy = sy = _mm512_loadu_pd(ly);
+		cnt = _mm512_loadu_pd(c);
+		for (k = 0, save_at = 1; k < max; k++) {
+			xx = _mm512_mul_pd(zx, zx);
+			yy = _mm512_mul_pd(zy, zy);
+			active = _mm512_mask_cmp_pd_mask(active, _mm512_add_pd(xx, yy), four, _CMP_LE_OQ);
+			if (!active)
+				break;
+			cnt = _mm512_mask_add_pd(cnt, active, cnt, one);
+			xt = _mm512_add_pd(_mm512_sub_pd(xx, yy), x0);
+			zy = _mm512_add_pd(_mm512_mul_pd(_mm512_add_pd(zx, zx), zy), y0);
+			zx = xt;
+			if (!checks)
+				continue;
+			cyc = _mm512_mask_cmp_pd_mask(active, zx, sx, _CMP_EQ_OQ);
+			cyc = _mm512_mask_cmp_pd_mask(cyc, zy, sy, _CMP_EQ_OQ);
+			if (cyc) {
+				cnt = _mm512_mask_mov_pd(cnt, cyc, maxv);
+				active &= ~cyc;
+			}
+			if (k + 1 == save_at) {
+				sx = zx;
+				sy = zy;
+				save_at *= 2;
+			}
+		}
+		_mm512_storeu_pd(c, cnt);
+		for (l = 0; l < 8 && i + l < n; l++)
+			iters[i + l] = c[l];
+	}
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+/*
+ * Single precision: twice the lanes for the same width. The points and the
+ * bulb test stay double, only the orbit is float, so the counts follow
+ * mandel_iterations_at_point() only as long as float resolves the steps
+ * between points (mandel_precision_for()).
+ */
+static int point_f32(float x0, float y0, int max, int checks)
+{
+	float x = x0, y = y0, xs = x0, ys = y0, xt;
+	int iter = 0;
+	long save_at = 1;
+
+	while (x * x + y * y <= 4 && iter < max) {
+		xt = x * x - y * y + x0;
+		y = 2 * x * y + y0;
+		x = xt;
+		++iter;
+		if (!checks)
+			continue;
+		if (x == xs && y == ys)
+			return max;
+		if (iter == save_at) {
+			xs = x;
+			ys = y;
+			save_at *= 2;
+		}
+	}
+	return iter;
+}
+
+static void points_scalar_f32(const double *x, int dx, const double *y, int dy,
+	int n, int max, int *iters)
+{
+	int i, checks = mandel_interior_checks();
+
+	for (i = 0; i < n; i++)
+		iters[i] = checks && mandel_in_main_bulbs(x[i * dx], y[i * dy]) ? max :
+			point_f32(x[i * dx], y[i * dy], max, checks);
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* start_lanes() in floats, with int masks */
+static unsigned start_lanes_f32(const double *x, int dx, const double *y, int dy,
+	int i, int n, int lanes, int max, int checks,
+	float *lx, float *ly, float *cnt, int *on)
+{
+	unsigned left = 0;
+	int l, k;
+
+	for (l = 0; l < lanes; l++) {
+		k = i + l < n ? i + l : n - 1;
+		lx[l] = x[k * dx];
+		ly[l] = y[k * dy];
+		if (checks && mandel_in_main_bulbs(x[k * dx], y[k * dy])) {
+			cnt[l] = max;
+			on[l] = 0;
+		} else {
+			cnt[l] = 0;
+			on[l] = -1;
+			left |= 1u << l;
+		}
+	}
+	return left;
+}
+
+__attribute__((target("sse2")))
+static void points_sse2_f32(const double *x, int dx, const double *y, int dy,
+	int n, int max, int *iters)
+{
+	const __m128 four = _mm_set1_ps(4.0f), one = _mm_set1_ps(1.0f);
+	const __m128 maxv = _mm_set1_ps(max);
+	__m128 x0, y0, zx, zy, xx, yy, active, cnt, xt, sx, sy, cyc;
+	float lx[4], ly[4], c[4];
+	int on[4], out[4];
+	long save_at;
+	int i, k, l, checks = mandel_interior_checks();
+
+	for (i = 0; i < n; i += 4) {
+		start_lanes_f32(x, dx, y, dy, i, n, 4, max, checks, lx, ly, c, on);
+		x0 = zx = sx = _mm_loadu_ps(lx);
+		y0 = zy = sy = _mm_loadu_ps(ly);
+		cnt = _mm_loadu_ps(c);
+		active = _mm_castsi128_ps(_mm_loadu_si128((__m128i *)on));
+		for (k = 0, save_at = 1; k < max; k++) {
+			xx = _mm_mul_ps(zx, zx);
+			yy = _mm_mul_ps(zy, zy);
+			active = _mm_and_ps(active, _mm_cmple_ps(_mm_add_ps(xx, yy), four));
+			if (!_mm_movemask_ps(active))
+				break;
+			cnt = _mm_add_ps(cnt, _mm_and_ps(active, one));
+			xt = _mm_add_ps(_mm_sub_ps(xx, yy), x0);
+			zy = _mm_add_ps(_mm_mul_ps(_mm_add_ps(zx, zx), zy), y0);
+			zx = xt;
+			if (!checks)
+				continue;
+			cyc = _mm_and_ps(active, _mm_and_ps(_mm_cmpeq_ps(zx, sx), _mm_cmpeq_ps(zy, sy)));
+			if (_mm_movemask_ps(cyc)) {
+				cnt = _mm_or_ps(_mm_andnot_ps(cyc, cnt), _mm_and_ps(cyc, maxv));
+				active = _mm_andnot_ps(cyc, active);
+			}
+			if (k + 1 == save_at) {
+				sx = zx;
+				sy = zy;
+				save_at *= 2;
+			}
+		}
+		_mm_storeu_si128((__m128i *)out, _mm_cvtps_epi32(cnt));
+		for (l = 0; l < 4 && i + l < n; l++)
+			iters[i + l] = out[l];
+	}
+}
+
+__attribute__((target("avx2")))
+static void points_avx2_f32(const double *x, int dx, const double *y, int dy,
+	int n, int max, int *iters)
+{
+	const __m256 four = _mm256_set1_ps(4.0f), one = _mm256_set1_ps(1.0f);
+	const __m256 maxv = _mm256_set1_ps(max);
+	__m256 x0, y0, zx, zy, xx, yy, active, cnt, xt, sx, sy, cyc;
+	float lx[8], ly[8], c[8];
+	int on[8], out[8];
+	long save_at;
+	int i, k, l, checks = mandel_interior_checks();
+
+	for (i = 0; i < n; i += 8) {
+		start_lanes_f32(x, dx, y, dy, i, n, 8, max, checks, lx, ly, c, on);
+		x0 = zx = sx = _mm256_loadu_ps(lx);
+		y0 = zy = sy = _mm256_loadu_ps(ly);
+		cnt = _mm256_loadu_ps(c);
+		active = _mm256_castsi256_ps(_mm256_loadu_si256((__m256i *)on));
+		for (k = 0, save_at = 1; k < max; k++) {
+			xx = _mm256_mul_ps(zx, zx);
+			yy = _mm256_mul_ps(zy, zy);
+			active = _mm256_and_ps(active,
+				_mm256_cmp_ps(_mm256_add_ps(xx, yy), four, _CMP_LE_OQ));
+			if (!_mm256_movemask_ps(active))
+				break;
+			cnt = _mm256_add_ps(cnt, _mm256_and_ps(active, one));
+			xt = _mm256_add_ps(_mm256_sub_ps(xx, yy), x0);
+			zy = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(zx, zx), zy), y0);
+			zx = xt;
+			if (!checks)
+				continue;
+			cyc = _mm256_and_ps(active, _mm256_and_ps(_mm256_cmp_ps(zx, sx, _CMP_EQ_OQ),
+				_mm256_cmp_ps(zy, sy, _CMP_EQ_OQ)));
+			if (_mm256_movemask_ps(cyc)) {
+				cnt = _mm256_blendv_ps(cnt, maxv, cyc);
+				active = _mm256_andnot_ps(cyc, active);
+			}
+			if (k + 1 == save_at) {
+				sx = zx;
+				sy = zy;
+				save_at *= 2;
+			}
+		}
+		_mm256_storeu_si256((__m256i *)out, _mm256_cvtps_epi32(cnt));
+		for (l = 0; l < 8 && i + l < n; l++)
+			iters[i + l] = out[l];
+	}
+}
+
+__attribute__((target("avx512f")))
+static void points_avx512_f32(const double *x, int dx, const double *y, int dy,
+	int n, int max, int *iters)
+{
+	const __m512 four = _mm512_set1_ps(4.0f), one = _mm512_set1_ps(1.0f);
+	const __m512 maxv = _mm512_set1_ps(max);
+	__m512 x0, y0, zx, zy, xx, yy, cnt, xt, sx, sy;
+	__mmask16 active, cyc;
+	float lx[16], ly[16], c[16];
+	int on[16], out[16];
+	long save_at;
+	int i, k, l, checks = mandel_interior_checks();
+
+	for (i = 0; i < n; i += 16) {
+		active = start_lanes_f32(x, dx, y, dy, i, n, 16, max, checks, lx, ly, c, on);
+		x0 = zx = sx = _mm512_loadu_ps(lx);
+		y0 = zy = sy = _mm512_loadu_ps(ly);
+		cnt = _mm512_loadu_ps(c);
+		for (k = 0, save_at = 1; k < max; k++) {
+			xx = _mm512_mul_ps(zx, zx);
+			yy = _mm512_mul_ps(zy, zy);
+			active = _mm512_mask_cmp_ps_mask(active, _mm512_add_ps(xx, yy), four, _CMP_LE_OQ);
+			if (!active)
+				break;
+			cnt = _mm512_mask_add_ps(cnt, active, cnt, one);
+			xt = _mm512_add_ps(_mm512_sub_ps(xx, yy), x0);
+			zy = _mm512_add_ps(_mm512_mul_ps(_mm512_add_ps(zx, zx), zy), y0);
+			zx = xt;
+			if (!checks)
+				continue;
+			cyc = _mm512_mask_cmp_ps_mask(active, zx, sx, _CMP_EQ_OQ);
+			cyc = _mm512_mask_cmp_ps_mask(cyc, zy, sy, _CMP_EQ_OQ);
+			if (cyc) {
+				cnt = _mm512_mask_mov_ps(cnt, cyc, maxv);
+				active &= ~cyc;
+			}
+			if (k + 1 == save_at) {
+				sx = zx;
+				sy = zy;
+				save_at *= 2;
+			}
+		}
+		_mm512_storeu_si512((__m512i *)out, _mm512_cvtps_epi32(cnt));
+		for (l = 0; l < 16 && i + l < n; l++)
+			iters[i + l] = out[l];
+	}
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+static const struct {
+	const char        *name;
+	mandel_kernel_fn  *fn[2];	/* by precision: MANDEL_FLOAT, MANDEL_DOUBLE */
+} kernels[] = {
+	/* widest first, the first one the CPU supports is the default */
+#ifdef HAVE_X86_KERNELS
+	{ "avx512", { points_avx512_f32, points_avx512 } },
+	{ "avx2",   { points_avx2_f32,   points_avx2 } },
+	{ "sse2",   { points_sse2_f32,   points_sse2 } },
+#endif
+	{ "scalar", { points_scalar_f32, points_scalar } },
+};
+
+#define NR_KERNELS ((int)(sizeof(kernels) / sizeof(kernels[0])))
+
+static int kernel_supported(int k)
+{
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (kernels[k].fn[MANDEL_DOUBLE] == points_avx512)
+		return __builtin_cpu_supports("avx512f");
+	if (kernels[k].fn[MANDEL_DOUBLE] == points_avx2)
+		return __builtin_cpu_supports("avx2");
+	if (kernels[k].fn[MANDEL_DOUBLE] == points_sse2)
+		return __builtin_cpu_supports("sse2");
+#endif
+	return 1;
+}
+
+/* picked once at startup, before any thread exists */
+static int current;
+static int precision = MANDEL_DOUBLE;
+
+__attribute__((constructor))
+static void pick_kernel(void)
+{
+	int k;
+
+	for (k = 0; k < NR_KERNELS && !kernel_supported(k); k++)
+		;
+	current = k;
+}
+
+/*
+ * Iteration counts of the n points (x[i], y), the same as
+ * n calls of mandel_iterations_at_point().
+ */
+void mandel_iterations_at_points(const double *x, double y, int n, int max, int *iters)
+{
+	kernels[current].fn[precision](x, 1, &y, 0, n, max, iters);
+}
+
+/* The same for any n points (x[i], y[i]), e.g. gathered from all over a tile. */
+void mandel_iterations_at_xy(const double *x, const double *y, int n, int max, int *iters)
+{
+	kernels[current].fn[precision](x, 1, y, 1, n, max, iters);
+}
+
+/* in precision p rather than the one set, for threads that draw views of different zooms */
+void mandel_iterations_at_points_prec(int p, const double *x, double y, int n, int max, int *iters)
+{
+	kernels[current].fn[p == MANDEL_FLOAT ? MANDEL_FLOAT : MANDEL_DOUBLE](x, 1, &y, 0, n, max, iters);
+}
+
+const char *mandel_kernel_name(void)
+{
+	return kernels[current].name;
+}
+
+/*
+ * Use the named kernel from now on, e.g. to compare them. Not to be
+ * called while other threads are computing.
+ * Returns -1 if there is no such kernel or the CPU cannot run it.
+ */
+int mandel_set_kernel(const char *name)
+{
+	int k;
+
+	for (k = 0; k < NR_KERNELS; k++)
+		if (!strcmp(kernels[k].name, name) && kernel_supported(k)) {
+			current = k;
+			return 0;
+		}
+	return -1;
+}
+
+/* Name of the k-th kernel, widest first, NULL past the end. */
+const char *mandel_kernel_at(int k)
+{
+	return k >= 0 && k < NR_KERNELS ? kernels[k].name : NULL;
+}
+
+/*
+ * The cheapest precision that tells apart points step apart around (x, y):
+ * float if a step is still PRECISION_ULPS_PER_STEP of its units in the last
+ * place there, and a count up to max fits its mantissa; double otherwise
+ * (past double, see mandel_deep_needed()).
+ */
+int mandel_precision_for(double x, double y, double step, int max)
+{
+	double m = fmax(fmax(fabs(x), fabs(y)), 1.0);
+
+	if (step >= PRECISION_ULPS_PER_STEP * FLT_EPSILON * m && max <= 1 << FLT_MANT_DIG)
+		return MANDEL_FLOAT;
+	return MANDEL_DOUBLE;
+}
+
+/* Use precision p from now on; not while other threads are computing. */
+void mandel_set_precision(int p)
+{
+	precision = p == MANDEL_FLOAT ? MANDEL_FLOAT : MANDEL_DOUBLE;
+}
+
+int mandel_precision(void)
+{
+	return precision;
+}
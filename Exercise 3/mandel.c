@@ -12,11 +12,17 @@
 #include <math.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
 #include <errno.h>
 #include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/uio.h>
 
 #include "mandel-lib.h"
+#include "mandel-image.h"
+#include "mandel-deep.h"
 
 #define MANDEL_MAX_ITERATION 100000
 
@@ -46,9 +52,47 @@ typedef struct
 	pthread_t tid;								//id gia kathe thread pou kanw create, oste na ginoun argotera join
 	int l;									//to antistoixo line		
 	sem_t mutex;								//to antistoixo semaphore metaksi line kai line+1
+	double idle_ms;								//time spent waiting to output, not computing
+	double busy_ms;								//time spent computing
+	long points;								//-M: points actually iterated
 }mystruct;
 mystruct *saved;								//malloc gia n sth main
 
+/*
+ * Reorder buffer between the workers and a single writer thread.
+ * A worker drops a finished line into the slot of its line number and
+ * goes on with the next one; the writer prints lines in order as soon as
+ * the next one is there. A worker only waits when its line is a whole
+ * buffer ahead of the output (-s: the old semaphore chain instead,
+ * where every line waits for the one before it to be printed).
+ */
+#define REORDER_LINES_PER_THREAD 4
+#define WRITE_BATCH 64	/* lines per writev() */
+
+struct reorder_buffer {
+	pthread_mutex_t  lock;
+	pthread_cond_t   space;		/* next_out has moved on */
+	pthread_cond_t   ready;		/* the line at next_out is there */
+	int              nr_slots;
+	int              next_out;	/* first line not written yet */
+	int              *filled;
+	size_t           *len;
+	char             *bufs;		/* nr_slots lines of MANDEL_LINE_BYTES(x_chars) */
+	double           writer_idle_ms;
+} rb;
+int use_semaphores = 0;
+
+/* who computes what: lines round-robin, or tiles (see compute_mandel_tiles()) */
+#define SCHED_STATIC  0
+#define SCHED_STEAL   1
+#define SCHED_COUNTER 2
+
+int sched = SCHED_STATIC;
+int tile_rows = 2, tile_cols = 30;
+
+/* -o: an image file of x_chars x y_chars pixels instead of the terminal */
+struct mandel_image *image;
+
 
 /*
  * The part of the complex plane to be drawn:
@@ -56,6 +100,13 @@ mystruct *saved;								//malloc gia n sth main
 */
 double xmin = -1.8, xmax = 1.0;
 double ymin = -1.0, ymax = 1.0;
+int max_iter = MANDEL_MAX_ITERATION;
+
+/*
+ * -c/-z beyond what doubles resolve: the corners above are offsets from
+ * the center, and every point goes through the perturbation engine.
+ */
+struct mandel_deep *deep;
 	
 /*
  * Every character in the final output is
@@ -64,60 +115,105 @@ double ymin = -1.0, ymax = 1.0;
 double xstep;
 double ystep;
 
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 /*
- * This function computes a line of output
- * as an array of x_char color values.
+ * The x of every column, accumulated once from xmin in steps of xstep as
+ * the lines always did it, so that any part of a line sees the same points.
  */
-void compute_mandel_line(int line, int color_val[])
+double *xcoord;
+
+static void init_xcoord(void)
 {
-	/*
-	 * x and y traverse the complex plane.
-	 */
-	double x, y;
+	double x;
+	int n;
+
+	xcoord = malloc(x_chars * sizeof(*xcoord));
+	if (!xcoord) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (x = xmin, n = 0; n < x_chars; x += xstep, n++)
+		xcoord[n] = x;
+}
+
+/* iteration counts of the points (x[i], y), or (x[i], y[i]), whichever engine draws */
+static void iterate_points(const double *x, double y, int n, int *iters)
+{
+	if (deep)
+		mandel_deep_iterations_at_points(deep, x, y, n, iters);
+	else
+		mandel_iterations_at_points(x, y, n, max_iter, iters);
+}
+
+static void iterate_xy(const double *x, const double *y, int n, int *iters)
+{
+	if (deep)
+		mandel_deep_iterations_at_xy(deep, x, y, n, iters);
+	else
+		mandel_iterations_at_xy(x, y, n, max_iter, iters);
+}
 
+/*
+ * This function computes columns c0 to c1 - 1 of a line of output
+ * as color values, in color_val[c0] to color_val[c1 - 1].
+ */
+void compute_mandel_segment(int line, int c0, int c1, int color_val[])
+{
+	double y;
 	int n;
 	int val;
 
 	/* Find out the y value corresponding to this line */
 	y = ymax - ystep * line;
 
-	/* and iterate for all points on this line */
-	for (x = xmin, n = 0; n < x_chars; x+= xstep, n++) {
+	/* iterate for all these points at once, several per instruction */
+	iterate_points(xcoord + c0, y, c1 - c0, color_val + c0);
+
+	for (n = c0; n < c1; n++) {
 
 		/* Compute the point's color value */
-		val = mandel_iterations_at_point(x, y, MANDEL_MAX_ITERATION);
+		val = color_val[n];
 		if (val > 255)
 			val = 255;
 
-		/* And store it in the color_val[] array */
-		val = xterm_color(val);
+		/* And store it in the color_val[] array, the palette maps it on output */
 		color_val[n] = val;
 	}
 }
 
+/*
+ * This function computes a line of output
+ * as an array of x_char color values.
+ */
+void compute_mandel_line(int line, int color_val[])
+{
+	compute_mandel_segment(line, 0, x_chars, color_val);
+}
+
+/*
+ * Set the color only when it changes along a line (-e: before every cell,
+ * the exact bytes of one set_xterm_color() per cell).
+ */
+int coalesce = 1;
+
 /*
  * This function outputs an array of x_char color values
- * to a 256-color xterm.
+ * to a 256-color xterm, with a single write.
  */
 void output_mandel_line(int fd, int color_val[])
 {
-	int i;
-	
-	char point ='@';
-	char newline='\n';
-
-	for (i = 0; i < x_chars; i++) {
-		/* Set the current color, then output the point */
-		set_xterm_color(fd, color_val[i]);
-		if (write(fd, &point, 1) != 1) {
-			perror("compute_and_output_mandel_line: write point");
-			exit(1);
-		}
-	}
+	char buf[MANDEL_LINE_BYTES(x_chars)];
+	size_t len;
 
-	/* Now that the line is done, output a newline character */
-	if (write(fd, &newline, 1) != 1) {
-		perror("compute_and_output_mandel_line: write newline");
+	len = mandel_render_line(buf, color_val, x_chars, coalesce);
+	if (insist_write(fd, buf, len) != len) {
+		perror("compute_and_output_mandel_line: write line");
 		exit(1);
 	}
 }
@@ -125,26 +221,743 @@ void output_mandel_line(int fd, int color_val[])
 void *compute_and_output_mandel_line(void *arg)
 {
 	int k;							//Trexousa grammh
-	int line=*(int*)arg;					//Proth grammh tou Thread(0..n-1)
+	mystruct *me = arg;
+	int line=me->l;						//Proth grammh tou Thread(0..n-1)
+	double t;
 	for (k = line; k < y_chars; k += n){			//kai gia tis epomenes me vima n
 		int color_val[x_chars];
+		t = now_ms();
 		compute_mandel_line(k, color_val);              //Ypologismos k grammhs *parallhla
+		me->busy_ms += now_ms() - t;
                                                                 //Sygxronismos:
+		t = now_ms();
                 sem_wait(&saved[(k % n)].mutex);                //perimenoun to semaphore tou Thread tous.
+		me->idle_ms += now_ms() - t;
                 output_mandel_line(1, color_val);               //Print *sigxronismena.
                 sem_post(&saved[((k % n)+1)%n].mutex);          //Auksanoun to semaphore tou epomenou Thread.
 	}
 	return 0;
 }
 
+/*
+ * Hand line k over to the writer: wait for its slot to be free,
+ * render into it and mark it filled.
+ */
+static void reorder_buffer_put(mystruct *me, int k, const int *color_val)
+{
+	int slot = k % rb.nr_slots;
+	double t;
+
+	pthread_mutex_lock(&rb.lock);
+	t = now_ms();
+	while (k >= rb.next_out + rb.nr_slots)
+		pthread_cond_wait(&rb.space, &rb.lock);
+	me->idle_ms += now_ms() - t;
+	pthread_mutex_unlock(&rb.lock);
+
+	/* the slot is ours until the writer has printed it */
+	rb.len[slot] = mandel_render_line(rb.bufs + slot * MANDEL_LINE_BYTES(x_chars),
+		color_val, x_chars, coalesce);
+
+	pthread_mutex_lock(&rb.lock);
+	rb.filled[slot] = 1;
+	if (k == rb.next_out)
+		pthread_cond_signal(&rb.ready);
+	pthread_mutex_unlock(&rb.lock);
+}
+
+/* a worker of the reorder buffer: compute, render into the line's slot, go on */
+void *compute_mandel_lines(void *arg)
+{
+	mystruct *me = arg;
+	int k;
+	double t;
+
+	for (k = me->l; k < y_chars; k += n) {
+		int color_val[x_chars];
+		t = now_ms();
+		compute_mandel_line(k, color_val);
+		me->busy_ms += now_ms() - t;
+		reorder_buffer_put(me, k, color_val);
+	}
+	return 0;
+}
+
+/* writev() all of iov[0..cnt), however many calls it takes */
+static void writev_all(int fd, struct iovec *iov, int cnt)
+{
+	ssize_t ret;
+
+	while (cnt > 0) {
+		ret = writev(fd, iov, cnt);
+		if (ret < 0) {
+			perror("write_mandel_lines: writev");
+			exit(1);
+		}
+		for (; cnt > 0 && (size_t)ret >= iov->iov_len; iov++, cnt--)
+			ret -= iov->iov_len;
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+}
+
+/* the writer: every run of lines that is ready goes out with one writev() */
+void *write_mandel_lines(void *arg)
+{
+	struct iovec iov[WRITE_BATCH];
+	int first, m, i, slot;
+	double t;
+
+	pthread_mutex_lock(&rb.lock);
+	while (rb.next_out < y_chars) {
+		t = now_ms();
+		while (!rb.filled[rb.next_out % rb.nr_slots])
+			pthread_cond_wait(&rb.ready, &rb.lock);
+		rb.writer_idle_ms += now_ms() - t;
+
+		first = rb.next_out;
+		for (m = 0; m < WRITE_BATCH && m < rb.nr_slots && first + m < y_chars; m++) {
+			slot = (first + m) % rb.nr_slots;
+			if (!rb.filled[slot])
+				break;
+			iov[m].iov_base = rb.bufs + slot * MANDEL_LINE_BYTES(x_chars);
+			iov[m].iov_len = rb.len[slot];
+		}
+		pthread_mutex_unlock(&rb.lock);
+
+		writev_all(1, iov, m);
+
+		pthread_mutex_lock(&rb.lock);
+		for (i = 0; i < m; i++)
+			rb.filled[(first + i) % rb.nr_slots] = 0;
+		rb.next_out += m;
+		pthread_cond_broadcast(&rb.space);
+	}
+	pthread_mutex_unlock(&rb.lock);
+	return 0;
+}
+
+static void reorder_buffer_init(void)
+{
+	rb.nr_slots = REORDER_LINES_PER_THREAD * n;
+	/* tiles finish bands in any order, a slot for every line so nobody waits */
+	if (rb.nr_slots > y_chars || sched != SCHED_STATIC)
+		rb.nr_slots = y_chars;
+	rb.next_out = 0;
+	rb.writer_idle_ms = 0;
+	rb.filled = calloc(rb.nr_slots, sizeof(*rb.filled));
+	rb.len = calloc(rb.nr_slots, sizeof(*rb.len));
+	rb.bufs = malloc(rb.nr_slots * MANDEL_LINE_BYTES(x_chars));
+	if (!rb.filled || !rb.len || !rb.bufs) {
+		fprintf(stderr, "reorder buffer: out of memory\n");
+		exit(1);
+	}
+	pthread_mutex_init(&rb.lock, NULL);
+	pthread_cond_init(&rb.space, NULL);
+	pthread_cond_init(&rb.ready, NULL);
+}
+
+static void reorder_buffer_destroy(void)
+{
+	pthread_mutex_destroy(&rb.lock);
+	pthread_cond_destroy(&rb.space);
+	pthread_cond_destroy(&rb.ready);
+	free(rb.filled);
+	free(rb.len);
+	free(rb.bufs);
+}
+
+/*
+ * Tile scheduling (-m steal or -m counter): the frame is cut into tiles of
+ * tile_rows x tile_cols characters, handed out while the frame is drawn, so
+ * that a thread that got cheap tiles goes on with someone else's expensive
+ * ones. Finished tiles land in a frame sized array of color values; the
+ * thread that finishes the last tile of a band of rows renders its lines
+ * into the reorder buffer, which holds the whole frame here, so nobody
+ * ever waits for the writer.
+ *
+ * steal:   tiles are dealt out in contiguous runs to one deque per thread.
+ *          A thread takes its own from the bottom; once it runs dry it
+ *          steals from the top of the others' (Chase-Lev, without growing:
+ *          -M pushes at most a few dozen rectangles on top of the tiles).
+ * counter: one shared atomic counter, the next tile goes to whoever asks.
+ */
+struct tile_deque {
+	long  top;		/* stolen from here */
+	long  bottom;		/* the owner pushes and pops here */
+	long  mask;		/* tasks has mask + 1 places, a power of 2 */
+	long  *tasks;		/* tile numbers, or TASK_RECT rectangles for -M */
+} __attribute__((aligned(64)));	/* one cache line each, thieves hammer top */
+
+struct {
+	int                nr_tiles, tiles_per_row;
+	long               next_tile;	/* SCHED_COUNTER */
+	struct tile_deque  *deques;	/* SCHED_STEAL, one per thread */
+	long               *band_left;	/* tiles (-M: pixels) of every band of rows still to do */
+	long               pixels_left;	/* -M: of the whole frame */
+	int                *colors;	/* y_chars x x_chars color values, -M: iteration counts */
+} frame;
+
+/*
+ * Mariani-Silver subdivision (-M): of a tile only the border is computed.
+ * If all of it took the same number of iterations, the inside is taken to
+ * be the same and filled in (a filament of the set thinner than a pixel can
+ * slip through, so a handful of pixels may differ from -m steal); if not, a
+ * cross through the middle is computed and the four quarters go on the same
+ * way, each with its border known. The quarters are tasks of their own: three are pushed
+ * on the thread's deque, where idle threads can steal them, the fourth is
+ * done right away (with -m counter, all four right here).
+ *
+ * A rectangle is packed in a task as its corners, borders included.
+ */
+int mariani = 0;
+
+#define TASK_RECT     (1L << 62)	/* not a tile number; keeps tasks >= 0 */
+#define TASK_BITS     15
+#define TASK_MAX      ((1 << TASK_BITS) - 1)
+#define TASK_FIELD(task, k) ((int)((task) >> ((k) * TASK_BITS)) & TASK_MAX)
+#define MS_MIN_SIDE   4			/* below this, computing beats dividing */
+#define MS_PUSH_ROOM  256		/* deque places for pushed rectangles */
+
+static long rect_task(int x0, int y0, int x1, int y1)
+{
+	return TASK_RECT | x0 | (long)y0 << TASK_BITS |
+		(long)x1 << 2 * TASK_BITS | (long)y1 << 3 * TASK_BITS;
+}
+
+/* owner only; -1 if the deque is full */
+static int deque_push(struct tile_deque *d, long task)
+{
+	long b, t;
+
+	b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+	t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	if (b - t > d->mask)
+		return -1;
+	__atomic_store_n(&d->tasks[b & d->mask], task, __ATOMIC_RELAXED);
+	/* a thief that sees the new bottom sees the task too */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static long deque_pop(struct tile_deque *d)
+{
+	long b, t, task = -1;
 
-int main(void)
+	b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+	if (t <= b) {
+		task = __atomic_load_n(&d->tasks[b & d->mask], __ATOMIC_RELAXED);
+		if (t == b) {
+			/* the last one, a thief may be after it too */
+			if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+					__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+				task = -1;
+			__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+		}
+	} else {
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return task;
+}
+
+/* -1: empty, -2: lost a race, worth trying again */
+static long deque_steal(struct tile_deque *d)
+{
+	long t, b, task;
+
+	t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b)
+		return -1;
+	task = __atomic_load_n(&d->tasks[t & d->mask], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return -2;
+	return task;
+}
+
+/* the next task for thread self, -1 when the frame is done */
+static long next_tile(int self)
+{
+	int v, contended;
+	long k, task;
+
+	if (sched == SCHED_COUNTER) {
+		k = __atomic_fetch_add(&frame.next_tile, 1, __ATOMIC_RELAXED);
+		return k < frame.nr_tiles ? k : -1;
+	}
+	task = deque_pop(&frame.deques[self]);
+	if (task >= 0)
+		return task;
+	/*
+	 * ours is empty: go round the others until they all are. With -M a
+	 * busy thread may still push quarters, so wait for the last pixel.
+	 */
+	for (;;) {
+		contended = 0;
+		for (v = 1; v < n; v++) {
+			task = deque_steal(&frame.deques[(self + v) % n]);
+			if (task >= 0)
+				return task;
+			contended |= task == -2;
+		}
+		if (contended)
+			continue;
+		if (!mariani || !__atomic_load_n(&frame.pixels_left, __ATOMIC_ACQUIRE))
+			return -1;
+		sched_yield();
+	}
+}
+
+/* lines of a finished band, to the image or the writer */
+static void output_band(mystruct *me, int band)
+{
+	int line, last;
+
+	last = band * tile_rows + tile_rows < y_chars ? band * tile_rows + tile_rows : y_chars;
+	for (line = band * tile_rows; line < last; line++) {
+		if (image)
+			mandel_image_put(image, line, 0, x_chars, frame.colors + (size_t)line * x_chars);
+		else
+			reorder_buffer_put(me, line, frame.colors + (size_t)line * x_chars);
+	}
+}
+
+/* -M: cnt more pixels of band are final */
+static void ms_finish(mystruct *me, int band, long cnt)
+{
+	if (cnt == 0)
+		return;
+	__atomic_sub_fetch(&frame.pixels_left, cnt, __ATOMIC_ACQ_REL);
+	/* acq_rel: whoever finishes the band sees the other pixels of it */
+	if (__atomic_sub_fetch(&frame.band_left[band], cnt, __ATOMIC_ACQ_REL) == 0)
+		output_band(me, band);
+}
+
+/*
+ * -M: the points to compute are gathered, from the sides of rectangles and
+ * from small insides, and iterated together: a row of a few points at a time
+ * would leave most lanes of the kernel idle, and near the set, where the
+ * rectangles get small, the points are the expensive ones. The batch is
+ * flushed before a border is looked at; the insides, which nobody looks
+ * at, pile up until the batch is full or the task is over.
+ */
+#define MS_BATCH 256
+
+struct ms_batch {
+	int     n;
+	double  x[MS_BATCH], y[MS_BATCH];
+	size_t  at[MS_BATCH];	/* where in frame.colors */
+};
+
+static void ms_flush(mystruct *me, struct ms_batch *b)
+{
+	int iters[MS_BATCH], i, first;
+
+	if (b->n == 0)
+		return;
+	iterate_xy(b->x, b->y, b->n, iters);
+	for (i = 0; i < b->n; i++)
+		frame.colors[b->at[i]] = iters[i];
+	me->points += b->n;
+
+	/* the points are final now, band by band */
+	for (first = 0, i = 1; i <= b->n; i++)
+		if (i == b->n || b->at[i] / x_chars / tile_rows != b->at[first] / x_chars / tile_rows) {
+			ms_finish(me, b->at[first] / x_chars / tile_rows, i - first);
+			first = i;
+		}
+	b->n = 0;
+}
+
+/* columns x0 to x1 of line, or rows y0 to y1 of column x, into the batch */
+static void ms_row(mystruct *me, struct ms_batch *b, int line, int x0, int x1)
+{
+	int x;
+
+	for (x = x0; x <= x1; x++) {
+		if (b->n == MS_BATCH)
+			ms_flush(me, b);
+		b->x[b->n] = xcoord[x];
+		b->y[b->n] = ymax - ystep * line;
+		b->at[b->n++] = (size_t)line * x_chars + x;
+	}
+}
+
+static void ms_column(mystruct *me, struct ms_batch *b, int x, int y0, int y1)
+{
+	int line;
+
+	for (line = y0; line <= y1; line++)
+		ms_row(me, b, line, x, x);
+}
+
+/* the one count all around the rectangle, -1 if there is more than one */
+static int ms_border(int x0, int y0, int x1, int y1)
+{
+	int *top = frame.colors + (size_t)y0 * x_chars;
+	int *bottom = frame.colors + (size_t)y1 * x_chars;
+	int val = top[x0], x, line;
+
+	for (x = x0; x <= x1; x++)
+		if (top[x] != val || bottom[x] != val)
+			return -1;
+	for (line = y0 + 1; line < y1; line++)
+		if (frame.colors[(size_t)line * x_chars + x0] != val ||
+		    frame.colors[(size_t)line * x_chars + x1] != val)
+			return -1;
+	return val;
+}
+
+/* -M: the inside of a rectangle whose border is done */
+static void ms_rect(mystruct *me, struct ms_batch *b, int x0, int y0, int x1, int y1)
+{
+	int band = y0 / tile_rows, val, xm, ym, x, line;
+	long quarter[3];
+	int q;
+
+	for (;;) {
+		if (x1 - x0 < 2 || y1 - y0 < 2)
+			return;
+
+		val = ms_border(x0, y0, x1, y1);
+		if (val >= 0) {
+			for (line = y0 + 1; line < y1; line++)
+				for (x = x0 + 1; x < x1; x++)
+					frame.colors[(size_t)line * x_chars + x] = val;
+			ms_finish(me, band, (long)(x1 - x0 - 1) * (y1 - y0 - 1));
+			return;
+		}
+		if (x1 - x0 <= MS_MIN_SIDE || y1 - y0 <= MS_MIN_SIDE) {
+			for (line = y0 + 1; line < y1; line++)
+				ms_row(me, b, line, x0 + 1, x1 - 1);
+			return;
+		}
+
+		/* the cross through the middle, the borders the quarters share */
+		xm = (x0 + x1) / 2;
+		ym = (y0 + y1) / 2;
+		ms_row(me, b, ym, x0 + 1, x1 - 1);
+		ms_column(me, b, xm, y0 + 1, ym - 1);
+		ms_column(me, b, xm, ym + 1, y1 - 1);
+		ms_flush(me, b);
+
+		quarter[0] = rect_task(xm, y0, x1, ym);
+		quarter[1] = rect_task(x0, ym, xm, y1);
+		quarter[2] = rect_task(xm, ym, x1, y1);
+		for (q = 0; q < 3; q++)
+			if (sched == SCHED_COUNTER || deque_push(&frame.deques[me->l], quarter[q]) < 0)
+				ms_rect(me, b, TASK_FIELD(quarter[q], 0), TASK_FIELD(quarter[q], 1),
+					TASK_FIELD(quarter[q], 2), TASK_FIELD(quarter[q], 3));
+		x1 = xm;
+		y1 = ym;
+	}
+}
+
+/* -M: a whole tile, its border first */
+static void ms_tile(mystruct *me, struct ms_batch *b, int x0, int y0, int x1, int y1)
+{
+	ms_row(me, b, y0, x0, x1);
+	if (y1 > y0) {
+		ms_row(me, b, y1, x0, x1);
+		ms_column(me, b, x0, y0 + 1, y1 - 1);
+		if (x1 > x0)
+			ms_column(me, b, x1, y0 + 1, y1 - 1);
+	}
+	ms_flush(me, b);
+	ms_rect(me, b, x0, y0, x1, y1);
+}
+
+void *compute_mandel_tiles(void *arg)
+{
+	mystruct *me = arg;
+	int band, line, last, c0, c1;
+	long task;
+	double t;
+	struct ms_batch batch = { 0 };
+
+	while ((task = next_tile(me->l)) >= 0) {
+		if (task & TASK_RECT) {
+			t = now_ms();
+			ms_rect(me, &batch, TASK_FIELD(task, 0), TASK_FIELD(task, 1),
+				TASK_FIELD(task, 2), TASK_FIELD(task, 3));
+			ms_flush(me, &batch);
+			me->busy_ms += now_ms() - t;
+			continue;
+		}
+		band = task / frame.tiles_per_row;
+		c0 = task % frame.tiles_per_row * tile_cols;
+		c1 = c0 + tile_cols < x_chars ? c0 + tile_cols : x_chars;
+		last = band * tile_rows + tile_rows < y_chars ? band * tile_rows + tile_rows : y_chars;
+
+		t = now_ms();
+		if (mariani) {
+			ms_tile(me, &batch, c0, band * tile_rows, c1 - 1, last - 1);
+			ms_flush(me, &batch);
+			me->busy_ms += now_ms() - t;
+			continue;
+		}
+		for (line = band * tile_rows; line < last; line++) {
+			if (image) {
+				/* raw counts, y as in compute_mandel_segment(), straight into the file */
+				int iters[c1 - c0];
+				iterate_points(xcoord + c0, ymax - ystep * line, c1 - c0, iters);
+				mandel_image_put(image, line, c0, c1 - c0, iters);
+			} else {
+				compute_mandel_segment(line, c0, c1, frame.colors + (size_t)line * x_chars);
+			}
+		}
+		me->busy_ms += now_ms() - t;
+		if (image)
+			continue;
+
+		/* acq_rel: whoever finishes the band sees the other tiles of it */
+		if (__atomic_sub_fetch(&frame.band_left[band], 1, __ATOMIC_ACQ_REL) == 0)
+			output_band(me, band);
+	}
+	return 0;
+}
+
+static void tiles_init(void)
+{
+	int nr_bands, b, i, per, first, cnt;
+	long size;
+
+	frame.tiles_per_row = (x_chars + tile_cols - 1) / tile_cols;
+	nr_bands = (y_chars + tile_rows - 1) / tile_rows;
+	frame.nr_tiles = nr_bands * frame.tiles_per_row;
+	frame.next_tile = 0;
+	frame.pixels_left = (long)x_chars * y_chars;
+	frame.band_left = malloc(nr_bands * sizeof(*frame.band_left));
+	/* an image takes the pixels itself, unless -M has to look at them again */
+	frame.colors = image && !mariani ? NULL :
+		malloc((size_t)y_chars * x_chars * sizeof(*frame.colors));
+	frame.deques = calloc(n, sizeof(*frame.deques));
+	if (!frame.band_left || (!frame.colors && (!image || mariani)) || !frame.deques) {
+		fprintf(stderr, "tiles: out of memory\n");
+		exit(1);
+	}
+	for (b = 0; b < nr_bands; b++)
+		frame.band_left[b] = !mariani ? frame.tiles_per_row :
+			(long)x_chars * ((b + 1) * tile_rows < y_chars ? tile_rows : y_chars - b * tile_rows);
+
+	/* thread i gets the i-th run of tiles, reversed so that it pops them in order */
+	per = (frame.nr_tiles + n - 1) / n;
+	for (size = 1; size < per + (mariani ? MS_PUSH_ROOM : 0); size *= 2)
+		;
+	for (i = 0; i < n; i++) {
+		first = i * per;
+		cnt = first < frame.nr_tiles ? frame.nr_tiles - first : 0;
+		if (cnt > per)
+			cnt = per;
+		frame.deques[i].tasks = malloc(size * sizeof(long));
+		if (!frame.deques[i].tasks) {
+			fprintf(stderr, "tiles: out of memory\n");
+			exit(1);
+		}
+		for (b = 0; b < cnt; b++)
+			frame.deques[i].tasks[b] = first + cnt - 1 - b;
+		frame.deques[i].mask = size - 1;
+		frame.deques[i].top = 0;
+		frame.deques[i].bottom = cnt;
+	}
+}
+
+static void tiles_destroy(void)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		free(frame.deques[i].tasks);
+	free(frame.deques);
+	free(frame.band_left);
+	free(frame.colors);
+}
+
+static void usage(const char *prog)
+{
+	int k;
+
+	fprintf(stderr, "Usage: %s [-e] [-s] [-m static|steal|counter] [-T rowsxcols] [-M]\n"
+		"       [-o file [-W width] [-H height]] [-p palette] [-t]\n"
+		"       [-c re,im] [-z width] [-i max_iter] [-P] [-D]\n"
+		"  -e          a color escape before every cell, not just on changes\n"
+		"  -s          print in turn with a chain of semaphores, no writer thread\n"
+		"  -m sched    lines round-robin (static, the default), or tiles from\n"
+		"              work-stealing deques (steal) or a shared counter (counter)\n"
+		"  -T RxC      tiles of R lines by C columns (default 2x30, 16x256 for -o,\n"
+		"              64x64 for -M)\n"
+		"  -M          compute only the borders of tiles and fill the uniform ones\n"
+		"              (Mariani-Silver), tiles as for steal unless -m counter\n"
+		"  -o file     write an image instead, .ppm, .pfm (iteration counts)"
+#ifdef HAVE_ZLIB
+		" or .png"
+#endif
+		"\n"
+		"  -W, -H      its size in pixels (default 1920x1080)\n"
+		"  -c re,im    center of the view, as many digits as it takes\n"
+		"  -z width    width of the view (default 2.8, the height follows,\n"
+		"              with square pixels in an image)\n"
+		"  -i max      iteration limit (default %d)\n"
+		"  -P          perturbation from a multiprecision reference at the\n"
+		"              center, even where doubles would do (deep zooms use it\n"
+		"              anyway)\n"
+		"  -D          double precision even where float would do (shallow\n"
+		"              views use float, with twice the points per vector)\n"
+		"  -p palette  one of:", prog, MANDEL_MAX_ITERATION);
+	for (k = 0; mandel_palette_name(k); k++)
+		fprintf(stderr, " %s", mandel_palette_name(k));
+	fprintf(stderr, "\n  -t          24-bit colors instead of the 256 of xterm\n\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
 {	
 	signal(SIGINT, ResetAndExit);						//An erthei Ctrl-C signal phgaine sthn ResetAndExit
 
-	int line, ret;
+	int line, ret, opt, truecolor = 0;
+	pthread_t writer;
+	double t, idle = 0, busy = 0, busy_max = 0;
+	long points = 0;
+	static const char *sched_name[] = { "static", "steal", "counter" };
+	const char *palette = "classic";
+	const char *image_path = NULL;
+	int width = 1920, height = 1080, sched_given = 0, tiles_given = 0, format = 0;
+	char *center_x = NULL, *center_y = NULL, *end;
+	double view_w = xmax - xmin, view_h, cx, cy;
+	int perturb = 0, use_double = 0;
+
+	while ((opt = getopt(argc, argv, "esm:T:Mo:W:H:p:tc:z:i:PD")) != -1) {
+		switch (opt) {
+		case 'e':
+			coalesce = 0;
+			break;
+		case 's':
+			use_semaphores = 1;
+			break;
+		case 'm':
+			if (!strcmp(optarg, "static"))
+				sched = SCHED_STATIC;
+			else if (!strcmp(optarg, "steal"))
+				sched = SCHED_STEAL;
+			else if (!strcmp(optarg, "counter"))
+				sched = SCHED_COUNTER;
+			else
+				usage(argv[0]);
+			sched_given = 1;
+			break;
+		case 'T':
+			if (sscanf(optarg, "%dx%d", &tile_rows, &tile_cols) != 2 ||
+			    tile_rows < 1 || tile_cols < 1)
+				usage(argv[0]);
+			tiles_given = 1;
+			break;
+		case 'M':
+			mariani = 1;
+			break;
+		case 'o':
+			image_path = optarg;
+			break;
+		case 'W':
+			width = atoi(optarg);
+			break;
+		case 'H':
+			height = atoi(optarg);
+			break;
+		case 'p':
+			palette = optarg;
+			break;
+		case 't':
+			truecolor = 1;
+			break;
+		case 'c':
+			center_x = optarg;
+			center_y = strchr(optarg, ',');
+			if (center_y == NULL)
+				usage(argv[0]);
+			*center_y++ = '\0';
+			break;
+		case 'z':
+			view_w = strtod(optarg, &end);
+			if (*end || !(view_w > 0))
+				usage(argv[0]);
+			break;
+		case 'i':
+			max_iter = atoi(optarg);
+			if (max_iter < 1)
+				usage(argv[0]);
+			break;
+		case 'P':
+			perturb = 1;
+			break;
+		case 'D':
+			use_double = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (mandel_set_palette(palette, truecolor) < 0 || (use_semaphores && sched != SCHED_STATIC))
+		usage(argv[0]);
+	if (image_path || mariani) {
+		/* pixels go to their place in the file, or -M divides tiles: only tiles make sense */
+		if (use_semaphores || (sched_given && sched == SCHED_STATIC))
+			usage(argv[0]);
+		if (!sched_given)
+			sched = SCHED_STEAL;
+		if (!tiles_given) {
+			tile_rows = mariani ? 64 : 16;
+			tile_cols = mariani ? 64 : 256;
+		}
+	}
+	if (image_path) {
+		format = mandel_image_format_of(image_path);
+		if (format < 0 || width < 1 || height < 1)
+			usage(argv[0]);
+		x_chars = width;
+		y_chars = height;
+	}
+	/* a rectangle of -M has to fit in a task */
+	if (mariani && (x_chars > TASK_MAX || y_chars > TASK_MAX))
+		usage(argv[0]);
+
+	if (center_x || view_w != xmax - xmin || perturb || image_path) {
+		/* the shape of the default view, or square pixels in an image, around the new center */
+		if (center_x == NULL) {
+			center_x = "-0.4";
+			center_y = "0";
+		}
+		view_h = image_path ? view_w * height / width : view_w * (ymax - ymin) / (xmax - xmin);
+		cx = strtod(center_x, &end);
+		if (*end)
+			usage(argv[0]);
+		cy = strtod(center_y, &end);
+		if (*end)
+			usage(argv[0]);
+		if (perturb || mandel_deep_needed(cx, cy, fmin(view_w / x_chars, view_h / y_chars))) {
+			deep = mandel_deep_create(center_x, center_y,
+				fmin(view_w / x_chars, view_h / y_chars), max_iter);
+			cx = cy = 0;
+		}
+		xmin = cx - view_w / 2;
+		xmax = cx + view_w / 2;
+		ymin = cy - view_h / 2;
+		ymax = cy + view_h / 2;
+	}
 	xstep = (xmax - xmin) / x_chars;
 	ystep = (ymax - ymin) / y_chars;
+	/* deep views have their own engine; otherwise float while it resolves a step */
+	if (!deep && !use_double)
+		mandel_set_precision(mandel_precision_for(fmax(fabs(xmin), fabs(xmax)),
+			fmax(fabs(ymin), fabs(ymax)), fmin(xstep, ystep), max_iter));
+	init_xcoord();
 	/*
 	 * draw the Mandelbrot Set, one line at a time.
 	 * Output is sent to file descriptor '1', i.e., standard output.
@@ -164,10 +977,28 @@ int main(void)
 			sem_init(&saved[line].mutex, 0, 0);			//me value 0 (waiting...)
 		}
 	}
+	fflush(stdout);								//the prompt goes out before any line
+	if (image_path)
+		image = mandel_image_create(image_path, width, height, format);
+	if (sched != SCHED_STATIC)
+		tiles_init();	/* after the image: it decides whether the pixels need an array */
+	t = now_ms();
+	if (!image_path && !use_semaphores) {
+		reorder_buffer_init();
+		ret = pthread_create(&writer, NULL, write_mandel_lines, NULL);
+		if (ret){
+			perror_pthread(ret, "pthread_create");
+			exit(1);
+		}
+	}
 	
 	for (line = 0; line < n; line++) {					//Crate n threads kai kathe ena pernaei kai to 
 		saved[line].l=line;						//antistoixo line gia na ksekinisei apo ekei
-		ret = pthread_create(&saved[line].tid, NULL, compute_and_output_mandel_line, &saved[line].l);
+		saved[line].idle_ms = saved[line].busy_ms = 0;
+		saved[line].points = 0;
+		ret = pthread_create(&saved[line].tid, NULL,
+			use_semaphores ? compute_and_output_mandel_line :
+			sched == SCHED_STATIC ? compute_mandel_lines : compute_mandel_tiles, &saved[line]);
 		if (ret){
 			perror_pthread(ret, "pthread_create");			//error check
                 	exit(1);
@@ -178,11 +1009,53 @@ int main(void)
 		ret = pthread_join(saved[line].tid, NULL);
 		if (ret)
                 	perror_pthread(ret, "pthread_join");			//error check
+		idle += saved[line].idle_ms;
+		busy += saved[line].busy_ms;
+		if (saved[line].busy_ms > busy_max)
+			busy_max = saved[line].busy_ms;
+		points += saved[line].points;
+	}
+	if (image)
+		mandel_image_close(image);
+	else if (!use_semaphores) {
+		ret = pthread_join(writer, NULL);
+		if (ret)
+			perror_pthread(ret, "pthread_join");
 	}
+	t = now_ms() - t;
 	for (line = 0; line < n; line++) {					//Kai destroy ta semaphores
 		sem_destroy(&saved[line].mutex);
 	}
 
+	/* how long the workers sat waiting for the output instead of computing */
+	fprintf(stderr, "%s: frame %.3f ms, workers idle %.3f of %.3f ms (%.1f%%)",
+		image ? image_path : use_semaphores ? "semaphores" : "reorder buffer", t, idle, n * t,
+		n * t > 0 ? 100.0 * idle / (n * t) : 0.0);
+	if (!image && !use_semaphores) {
+		fprintf(stderr, ", writer idle %.3f ms", rb.writer_idle_ms);
+		reorder_buffer_destroy();
+	}
+	fprintf(stderr, "\n");
+
+	/* the balance: a frame takes as long as the busiest thread */
+	fprintf(stderr, "%s: busy ms per thread", sched_name[sched]);
+	for (line = 0; line < n; line++)
+		fprintf(stderr, " %.3f", saved[line].busy_ms);
+	fprintf(stderr, ", busiest/mean %.2f\n", busy > 0 ? busy_max * n / busy : 1.0);
+	if (mariani)
+		fprintf(stderr, "mariani-silver: computed %ld of %ld points (%.1f%%)\n", points,
+			(long)x_chars * y_chars, 100.0 * points / ((double)x_chars * y_chars));
+	if (deep) {
+		fprintf(stderr, "perturbation: reference orbit of %d iterations, %ld rebases\n",
+			mandel_deep_orbit_length(deep), mandel_deep_rebases(deep));
+		mandel_deep_destroy(deep);
+	} else
+		fprintf(stderr, "kernel: %s, %s precision\n", mandel_kernel_name(),
+			mandel_precision() == MANDEL_FLOAT ? "float" : "double");
+	if (sched != SCHED_STATIC)
+		tiles_destroy();
+	free(xcoord);
+
 	reset_xterm_color(1);
 	return 0;
 }
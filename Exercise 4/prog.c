@@ -3,13 +3,26 @@
 #include <stdio.h>
 
 #include "proc-common.h"
+#include "workload.h"
 
 #define NMSG 200
 #define DELAY 130
 
 int main(int argc, char *argv[])
 {
-	int i, delay, pid;
+	int i, delay, pid, opt;
+	struct workload wl = { WL_CPU, 0 };
+
+	/*
+	 * -w profile[:usec] picks the kind of work done between messages,
+	 * see workload.h. Without usec the delay is random, in ms.
+	 */
+	while ((opt = getopt(argc, argv, "w:")) != -1) {
+		if (opt != 'w' || workload_parse(optarg, &wl) < 0) {
+			fprintf(stderr, "Usage: %s [-w cpu|mem|cache|io[:usec]]\n", argv[0]);
+			exit(1);
+		}
+	}
 
 	/*
 	 * Print a number of messages,
@@ -20,12 +33,15 @@ int main(int argc, char *argv[])
 	pid = getpid();
 	srand(pid);
 	delay = 30 + ((double)rand() / RAND_MAX) * DELAY;
-	printf("%s: Starting, NMSG = %d, delay = %d\n",
-		argv[0], NMSG, delay);
+	if (wl.usec == 0)
+		wl.usec = delay * 1000UL;
+	workload_calibrate(wl.profile);
+	printf("%s: Starting, NMSG = %d, delay = %lu us of %s\n",
+		argv[0], NMSG, wl.usec, workload_name(wl.profile));
 
 	for (i = 0; i < NMSG; i++) {
 		printf("%s[%d]: This is message %d\n", argv[0], pid, i);
-		compute(delay);
+		workload_run(wl.profile, wl.usec);
 	}
 
 	return 0;
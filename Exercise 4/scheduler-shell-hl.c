@@ -15,6 +15,7 @@
 /* Compile-time parameters. */
 #define SCHED_TQ_SEC 2                /* time quantum */
 #define TASK_NAME_SZ 60               /* maximum size for a task's name */
+#define READY_TIMEOUT_MS 10000        /* children must have stopped by then */
 #define SHELL_EXECUTABLE_NAME "shell" /* executable for shell */
 
 typedef struct proc {
@@ -90,6 +91,20 @@ do_child(char *executable)
 	exit(1);
 }
 
+/* Fill pids[] with the PIDs of all tasks in the list, return how many. */
+static int
+sched_task_pids(pid_t *pids)
+{
+	int n = 0;
+
+	temp = current_proc;
+	do {
+		pids[n++] = temp->PID;
+		temp = temp->next;
+	} while (temp != current_proc);
+	return n;
+}
+
 /* Print a list of all tasks currently being scheduled.  */
 static void
 sched_print_tasks(void)
@@ -402,7 +417,7 @@ int main(int argc, char *argv[])
 {
 	/* Two file descriptors for communication with the shell */
 	static int request_fd, return_fd;
-	pid_t p;
+	pid_t p, *pids;
 	int i;
 	nproc = argc; /* number of processes goes here */
 	/* Create the shell. */
@@ -421,7 +436,13 @@ int main(int argc, char *argv[])
 	}
 	
 	/* Wait for all children to raise SIGSTOP before exec()ing. */
-	wait_for_ready_children(nproc);
+	pids = malloc(nproc * sizeof(pid_t));
+	if (!pids) {
+		perror("malloc");
+		exit(1);
+	}
+	wait_for_ready_pids(pids, sched_task_pids(pids), READY_TIMEOUT_MS);
+	free(pids);
 
 	/* Install SIGALRM and SIGCHLD handlers. */
 	install_signal_handlers();
@@ -15,6 +15,7 @@
 /* Compile-time parameters. */
 #define SCHED_TQ_SEC 2                /* time quantum */
 #define TASK_NAME_SZ 60               /* maximum size for a task's name */
+#define READY_TIMEOUT_MS 10000        /* children must have stopped by then */
 
 /* Global Variables. */
 int *childid, *alive, current, nprog;
@@ -158,7 +159,7 @@ int main(int argc, char *argv[])
 	}
 
 	/* Wait for all children to raise SIGSTOP before exec()ing. */
-	wait_for_ready_children(nprog);
+	wait_for_ready_pids(childid, nprog, READY_TIMEOUT_MS);
 	/* Install SIGALRM and SIGCHLD handlers. */
 	install_signal_handlers();
 